@@ -21,9 +21,91 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// isolate_track_gc
+bool isolate_track_gc(SEXP ctx, bool enable);
+RcppExport SEXP _V8_isolate_track_gc(SEXP ctxSEXP, SEXP enableSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< bool >::type enable(enableSEXP);
+    rcpp_result_gen = Rcpp::wrap(isolate_track_gc(ctx, enable));
+    return rcpp_result_gen;
+END_RCPP
+}
+// isolate_stats
+Rcpp::List isolate_stats(SEXP ctx);
+RcppExport SEXP _V8_isolate_stats(SEXP ctxSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type ctx(ctxSEXP);
+    rcpp_result_gen = Rcpp::wrap(isolate_stats(ctx));
+    return rcpp_result_gen;
+END_RCPP
+}
+// profiler_start
+bool profiler_start(SEXP ctx, double interval);
+RcppExport SEXP _V8_profiler_start(SEXP ctxSEXP, SEXP intervalSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< double >::type interval(intervalSEXP);
+    rcpp_result_gen = Rcpp::wrap(profiler_start(ctx, interval));
+    return rcpp_result_gen;
+END_RCPP
+}
+// profiler_stop
+Rcpp::List profiler_stop(SEXP ctx);
+RcppExport SEXP _V8_profiler_stop(SEXP ctxSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type ctx(ctxSEXP);
+    rcpp_result_gen = Rcpp::wrap(profiler_stop(ctx));
+    return rcpp_result_gen;
+END_RCPP
+}
+// isolate_heap_snapshot
+std::string isolate_heap_snapshot(std::string path, SEXP ctx);
+RcppExport SEXP _V8_isolate_heap_snapshot(SEXP pathSEXP, SEXP ctxSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type ctx(ctxSEXP);
+    rcpp_result_gen = Rcpp::wrap(isolate_heap_snapshot(path, ctx));
+    return rcpp_result_gen;
+END_RCPP
+}
+// isolate_sampling_start
+bool isolate_sampling_start(SEXP ctx, double interval, int stack_depth);
+RcppExport SEXP _V8_isolate_sampling_start(SEXP ctxSEXP, SEXP intervalSEXP, SEXP stack_depthSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< double >::type interval(intervalSEXP);
+    Rcpp::traits::input_parameter< int >::type stack_depth(stack_depthSEXP);
+    rcpp_result_gen = Rcpp::wrap(isolate_sampling_start(ctx, interval, stack_depth));
+    return rcpp_result_gen;
+END_RCPP
+}
+// isolate_sampling_stop
+Rcpp::List isolate_sampling_stop(SEXP ctx);
+RcppExport SEXP _V8_isolate_sampling_stop(SEXP ctxSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type ctx(ctxSEXP);
+    rcpp_result_gen = Rcpp::wrap(isolate_sampling_stop(ctx));
+    return rcpp_result_gen;
+END_RCPP
+}
 // context_eval
-Rcpp::RObject context_eval(Rcpp::String src, ctxptr ctx, bool serialize, bool await);
-RcppExport SEXP _V8_context_eval(SEXP srcSEXP, SEXP ctxSEXP, SEXP serializeSEXP, SEXP awaitSEXP) {
+Rcpp::RObject context_eval(Rcpp::String src, ctxptr ctx, bool serialize, bool await, std::string cache);
+RcppExport SEXP _V8_context_eval(SEXP srcSEXP, SEXP ctxSEXP, SEXP serializeSEXP, SEXP awaitSEXP, SEXP cacheSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -31,20 +113,229 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< ctxptr >::type ctx(ctxSEXP);
     Rcpp::traits::input_parameter< bool >::type serialize(serializeSEXP);
     Rcpp::traits::input_parameter< bool >::type await(awaitSEXP);
-    rcpp_result_gen = Rcpp::wrap(context_eval(src, ctx, serialize, await));
+    Rcpp::traits::input_parameter< std::string >::type cache(cacheSEXP);
+    rcpp_result_gen = Rcpp::wrap(context_eval(src, ctx, serialize, await, cache));
+    return rcpp_result_gen;
+END_RCPP
+}
+// context_eval_stream
+Rcpp::RObject context_eval_stream(Rcpp::Function reader, ctxptr ctx, std::string name);
+RcppExport SEXP _V8_context_eval_stream(SEXP readerSEXP, SEXP ctxSEXP, SEXP nameSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::Function >::type reader(readerSEXP);
+    Rcpp::traits::input_parameter< ctxptr >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< std::string >::type name(nameSEXP);
+    rcpp_result_gen = Rcpp::wrap(context_eval_stream(reader, ctx, name));
+    return rcpp_result_gen;
+END_RCPP
+}
+// context_eval_file
+Rcpp::RObject context_eval_file(std::string path, ctxptr ctx);
+RcppExport SEXP _V8_context_eval_file(SEXP pathSEXP, SEXP ctxSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< ctxptr >::type ctx(ctxSEXP);
+    rcpp_result_gen = Rcpp::wrap(context_eval_file(path, ctx));
+    return rcpp_result_gen;
+END_RCPP
+}
+// context_get
+Rcpp::RObject context_get(Rcpp::String src, ctxptr ctx, bool await, bool simplify, bool copy);
+RcppExport SEXP _V8_context_get(SEXP srcSEXP, SEXP ctxSEXP, SEXP awaitSEXP, SEXP simplifySEXP, SEXP copySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::String >::type src(srcSEXP);
+    Rcpp::traits::input_parameter< ctxptr >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< bool >::type await(awaitSEXP);
+    Rcpp::traits::input_parameter< bool >::type simplify(simplifySEXP);
+    Rcpp::traits::input_parameter< bool >::type copy(copySEXP);
+    rcpp_result_gen = Rcpp::wrap(context_get(src, ctx, await, simplify, copy));
+    return rcpp_result_gen;
+END_RCPP
+}
+// context_eval_async
+promiseptr context_eval_async(Rcpp::String src, ctxptr ctx, std::string cache);
+RcppExport SEXP _V8_context_eval_async(SEXP srcSEXP, SEXP ctxSEXP, SEXP cacheSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::String >::type src(srcSEXP);
+    Rcpp::traits::input_parameter< ctxptr >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< std::string >::type cache(cacheSEXP);
+    rcpp_result_gen = Rcpp::wrap(context_eval_async(src, ctx, cache));
+    return rcpp_result_gen;
+END_RCPP
+}
+// promise_poll
+Rcpp::List promise_poll(promiseptr handle, std::string output, bool simplify);
+RcppExport SEXP _V8_promise_poll(SEXP handleSEXP, SEXP outputSEXP, SEXP simplifySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< promiseptr >::type handle(handleSEXP);
+    Rcpp::traits::input_parameter< std::string >::type output(outputSEXP);
+    Rcpp::traits::input_parameter< bool >::type simplify(simplifySEXP);
+    rcpp_result_gen = Rcpp::wrap(promise_poll(handle, output, simplify));
+    return rcpp_result_gen;
+END_RCPP
+}
+// context_function
+funptr context_function(Rcpp::String src, ctxptr ctx);
+RcppExport SEXP _V8_context_function(SEXP srcSEXP, SEXP ctxSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::String >::type src(srcSEXP);
+    Rcpp::traits::input_parameter< ctxptr >::type ctx(ctxSEXP);
+    rcpp_result_gen = Rcpp::wrap(context_function(src, ctx));
+    return rcpp_result_gen;
+END_RCPP
+}
+// function_call
+Rcpp::RObject function_call(funptr fun, Rcpp::List args, bool auto_unbox, bool await, bool simplify);
+RcppExport SEXP _V8_function_call(SEXP funSEXP, SEXP argsSEXP, SEXP auto_unboxSEXP, SEXP awaitSEXP, SEXP simplifySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< funptr >::type fun(funSEXP);
+    Rcpp::traits::input_parameter< Rcpp::List >::type args(argsSEXP);
+    Rcpp::traits::input_parameter< bool >::type auto_unbox(auto_unboxSEXP);
+    Rcpp::traits::input_parameter< bool >::type await(awaitSEXP);
+    Rcpp::traits::input_parameter< bool >::type simplify(simplifySEXP);
+    rcpp_result_gen = Rcpp::wrap(function_call(fun, args, auto_unbox, await, simplify));
+    return rcpp_result_gen;
+END_RCPP
+}
+// function_map
+Rcpp::List function_map(funptr fun, SEXP x, bool auto_unbox, bool await, bool simplify);
+RcppExport SEXP _V8_function_map(SEXP funSEXP, SEXP xSEXP, SEXP auto_unboxSEXP, SEXP awaitSEXP, SEXP simplifySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< funptr >::type fun(funSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type x(xSEXP);
+    Rcpp::traits::input_parameter< bool >::type auto_unbox(auto_unboxSEXP);
+    Rcpp::traits::input_parameter< bool >::type await(awaitSEXP);
+    Rcpp::traits::input_parameter< bool >::type simplify(simplifySEXP);
+    rcpp_result_gen = Rcpp::wrap(function_map(fun, x, auto_unbox, await, simplify));
     return rcpp_result_gen;
 END_RCPP
 }
 // write_array_buffer
-bool write_array_buffer(Rcpp::String key, Rcpp::RawVector data, ctxptr ctx);
-RcppExport SEXP _V8_write_array_buffer(SEXP keySEXP, SEXP dataSEXP, SEXP ctxSEXP) {
+bool write_array_buffer(Rcpp::String key, Rcpp::RawVector data, ctxptr ctx, bool copy);
+RcppExport SEXP _V8_write_array_buffer(SEXP keySEXP, SEXP dataSEXP, SEXP ctxSEXP, SEXP copySEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< Rcpp::String >::type key(keySEXP);
     Rcpp::traits::input_parameter< Rcpp::RawVector >::type data(dataSEXP);
     Rcpp::traits::input_parameter< ctxptr >::type ctx(ctxSEXP);
-    rcpp_result_gen = Rcpp::wrap(write_array_buffer(key, data, ctx));
+    Rcpp::traits::input_parameter< bool >::type copy(copySEXP);
+    rcpp_result_gen = Rcpp::wrap(write_array_buffer(key, data, ctx, copy));
+    return rcpp_result_gen;
+END_RCPP
+}
+// context_expose
+bool context_expose(Rcpp::String name, Rcpp::Function fun, ctxptr ctx, bool auto_unbox, bool simplify);
+RcppExport SEXP _V8_context_expose(SEXP nameSEXP, SEXP funSEXP, SEXP ctxSEXP, SEXP auto_unboxSEXP, SEXP simplifySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::String >::type name(nameSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Function >::type fun(funSEXP);
+    Rcpp::traits::input_parameter< ctxptr >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< bool >::type auto_unbox(auto_unboxSEXP);
+    Rcpp::traits::input_parameter< bool >::type simplify(simplifySEXP);
+    rcpp_result_gen = Rcpp::wrap(context_expose(name, fun, ctx, auto_unbox, simplify));
+    return rcpp_result_gen;
+END_RCPP
+}
+// context_assign
+bool context_assign(Rcpp::String key, SEXP value, ctxptr ctx, bool auto_unbox, bool typed, bool copy);
+RcppExport SEXP _V8_context_assign(SEXP keySEXP, SEXP valueSEXP, SEXP ctxSEXP, SEXP auto_unboxSEXP, SEXP typedSEXP, SEXP copySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::String >::type key(keySEXP);
+    Rcpp::traits::input_parameter< SEXP >::type value(valueSEXP);
+    Rcpp::traits::input_parameter< ctxptr >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< bool >::type auto_unbox(auto_unboxSEXP);
+    Rcpp::traits::input_parameter< bool >::type typed(typedSEXP);
+    Rcpp::traits::input_parameter< bool >::type copy(copySEXP);
+    rcpp_result_gen = Rcpp::wrap(context_assign(key, value, ctx, auto_unbox, typed, copy));
+    return rcpp_result_gen;
+END_RCPP
+}
+// context_serialize
+Rcpp::RawVector context_serialize(Rcpp::String src, ctxptr ctx, bool await);
+RcppExport SEXP _V8_context_serialize(SEXP srcSEXP, SEXP ctxSEXP, SEXP awaitSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::String >::type src(srcSEXP);
+    Rcpp::traits::input_parameter< ctxptr >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< bool >::type await(awaitSEXP);
+    rcpp_result_gen = Rcpp::wrap(context_serialize(src, ctx, await));
+    return rcpp_result_gen;
+END_RCPP
+}
+// context_deserialize
+bool context_deserialize(Rcpp::String key, Rcpp::RawVector blob, ctxptr ctx);
+RcppExport SEXP _V8_context_deserialize(SEXP keySEXP, SEXP blobSEXP, SEXP ctxSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::String >::type key(keySEXP);
+    Rcpp::traits::input_parameter< Rcpp::RawVector >::type blob(blobSEXP);
+    Rcpp::traits::input_parameter< ctxptr >::type ctx(ctxSEXP);
+    rcpp_result_gen = Rcpp::wrap(context_deserialize(key, blob, ctx));
+    return rcpp_result_gen;
+END_RCPP
+}
+// context_wasm_module
+bool context_wasm_module(Rcpp::String key, Rcpp::RawVector bytes, ctxptr ctx, std::string cache);
+RcppExport SEXP _V8_context_wasm_module(SEXP keySEXP, SEXP bytesSEXP, SEXP ctxSEXP, SEXP cacheSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::String >::type key(keySEXP);
+    Rcpp::traits::input_parameter< Rcpp::RawVector >::type bytes(bytesSEXP);
+    Rcpp::traits::input_parameter< ctxptr >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< std::string >::type cache(cacheSEXP);
+    rcpp_result_gen = Rcpp::wrap(context_wasm_module(key, bytes, ctx, cache));
+    return rcpp_result_gen;
+END_RCPP
+}
+// context_memory_view
+Rcpp::RObject context_memory_view(Rcpp::String src, ctxptr ctx, double offset, double length);
+RcppExport SEXP _V8_context_memory_view(SEXP srcSEXP, SEXP ctxSEXP, SEXP offsetSEXP, SEXP lengthSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::String >::type src(srcSEXP);
+    Rcpp::traits::input_parameter< ctxptr >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< double >::type offset(offsetSEXP);
+    Rcpp::traits::input_parameter< double >::type length(lengthSEXP);
+    rcpp_result_gen = Rcpp::wrap(context_memory_view(src, ctx, offset, length));
+    return rcpp_result_gen;
+END_RCPP
+}
+// context_memory_write
+bool context_memory_write(Rcpp::String src, SEXP data, ctxptr ctx, double offset);
+RcppExport SEXP _V8_context_memory_write(SEXP srcSEXP, SEXP dataSEXP, SEXP ctxSEXP, SEXP offsetSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::String >::type src(srcSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type data(dataSEXP);
+    Rcpp::traits::input_parameter< ctxptr >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< double >::type offset(offsetSEXP);
+    rcpp_result_gen = Rcpp::wrap(context_memory_write(src, data, ctx, offset));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -60,6 +351,40 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// context_console_options
+void context_console_options(ctxptr ctx, int level, Rcpp::RObject sink);
+RcppExport SEXP _V8_context_console_options(SEXP ctxSEXP, SEXP levelSEXP, SEXP sinkSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< ctxptr >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< int >::type level(levelSEXP);
+    Rcpp::traits::input_parameter< Rcpp::RObject >::type sink(sinkSEXP);
+    context_console_options(ctx, level, sink);
+    return R_NilValue;
+END_RCPP
+}
+// context_console_capture
+Rcpp::CharacterVector context_console_capture(ctxptr ctx, bool capture);
+RcppExport SEXP _V8_context_console_capture(SEXP ctxSEXP, SEXP captureSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< ctxptr >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< bool >::type capture(captureSEXP);
+    rcpp_result_gen = Rcpp::wrap(context_console_capture(ctx, capture));
+    return rcpp_result_gen;
+END_RCPP
+}
+// context_clear_timers
+void context_clear_timers(ctxptr ctx);
+RcppExport SEXP _V8_context_clear_timers(SEXP ctxSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< ctxptr >::type ctx(ctxSEXP);
+    context_clear_timers(ctx);
+    return R_NilValue;
+END_RCPP
+}
 // context_null
 bool context_null(ctxptr ctx);
 RcppExport SEXP _V8_context_null(SEXP ctxSEXP) {
@@ -71,25 +396,117 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// write_snapshot
+bool write_snapshot(std::string path, Rcpp::String src, bool set_console);
+RcppExport SEXP _V8_write_snapshot(SEXP pathSEXP, SEXP srcSEXP, SEXP set_consoleSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< Rcpp::String >::type src(srcSEXP);
+    Rcpp::traits::input_parameter< bool >::type set_console(set_consoleSEXP);
+    rcpp_result_gen = Rcpp::wrap(write_snapshot(path, src, set_console));
+    return rcpp_result_gen;
+END_RCPP
+}
 // make_context
-ctxptr make_context(bool set_console);
-RcppExport SEXP _V8_make_context(SEXP set_consoleSEXP) {
+ctxptr make_context(bool set_console, std::string snapshot, double heap_limit);
+RcppExport SEXP _V8_make_context(SEXP set_consoleSEXP, SEXP snapshotSEXP, SEXP heap_limitSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< bool >::type set_console(set_consoleSEXP);
-    rcpp_result_gen = Rcpp::wrap(make_context(set_console));
+    Rcpp::traits::input_parameter< std::string >::type snapshot(snapshotSEXP);
+    Rcpp::traits::input_parameter< double >::type heap_limit(heap_limitSEXP);
+    rcpp_result_gen = Rcpp::wrap(make_context(set_console, snapshot, heap_limit));
     return rcpp_result_gen;
 END_RCPP
 }
+// pool_new
+poolptr pool_new(int size, double heap_limit);
+RcppExport SEXP _V8_pool_new(SEXP sizeSEXP, SEXP heap_limitSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< int >::type size(sizeSEXP);
+    Rcpp::traits::input_parameter< double >::type heap_limit(heap_limitSEXP);
+    rcpp_result_gen = Rcpp::wrap(pool_new(size, heap_limit));
+    return rcpp_result_gen;
+END_RCPP
+}
+// pool_run
+Rcpp::List pool_run(poolptr pool, Rcpp::CharacterVector src, Rcpp::CharacterVector args, bool is_eval);
+RcppExport SEXP _V8_pool_run(SEXP poolSEXP, SEXP srcSEXP, SEXP argsSEXP, SEXP is_evalSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< poolptr >::type pool(poolSEXP);
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type src(srcSEXP);
+    Rcpp::traits::input_parameter< Rcpp::CharacterVector >::type args(argsSEXP);
+    Rcpp::traits::input_parameter< bool >::type is_eval(is_evalSEXP);
+    rcpp_result_gen = Rcpp::wrap(pool_run(pool, src, args, is_eval));
+    return rcpp_result_gen;
+END_RCPP
+}
+// pool_size
+int pool_size(poolptr pool);
+RcppExport SEXP _V8_pool_size(SEXP poolSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< poolptr >::type pool(poolSEXP);
+    rcpp_result_gen = Rcpp::wrap(pool_size(pool));
+    return rcpp_result_gen;
+END_RCPP
+}
+// pool_close
+void pool_close(poolptr pool);
+RcppExport SEXP _V8_pool_close(SEXP poolSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< poolptr >::type pool(poolSEXP);
+    pool_close(pool);
+    return R_NilValue;
+END_RCPP
+}
 
 static const R_CallMethodDef CallEntries[] = {
     {"_V8_version", (DL_FUNC) &_V8_version, 0},
-    {"_V8_context_eval", (DL_FUNC) &_V8_context_eval, 4},
-    {"_V8_write_array_buffer", (DL_FUNC) &_V8_write_array_buffer, 3},
+    {"_V8_isolate_track_gc", (DL_FUNC) &_V8_isolate_track_gc, 2},
+    {"_V8_isolate_stats", (DL_FUNC) &_V8_isolate_stats, 1},
+    {"_V8_profiler_start", (DL_FUNC) &_V8_profiler_start, 2},
+    {"_V8_profiler_stop", (DL_FUNC) &_V8_profiler_stop, 1},
+    {"_V8_isolate_heap_snapshot", (DL_FUNC) &_V8_isolate_heap_snapshot, 2},
+    {"_V8_isolate_sampling_start", (DL_FUNC) &_V8_isolate_sampling_start, 3},
+    {"_V8_isolate_sampling_stop", (DL_FUNC) &_V8_isolate_sampling_stop, 1},
+    {"_V8_context_eval", (DL_FUNC) &_V8_context_eval, 5},
+    {"_V8_context_eval_stream", (DL_FUNC) &_V8_context_eval_stream, 3},
+    {"_V8_context_eval_file", (DL_FUNC) &_V8_context_eval_file, 2},
+    {"_V8_context_get", (DL_FUNC) &_V8_context_get, 5},
+    {"_V8_context_eval_async", (DL_FUNC) &_V8_context_eval_async, 3},
+    {"_V8_promise_poll", (DL_FUNC) &_V8_promise_poll, 3},
+    {"_V8_context_function", (DL_FUNC) &_V8_context_function, 2},
+    {"_V8_function_call", (DL_FUNC) &_V8_function_call, 5},
+    {"_V8_function_map", (DL_FUNC) &_V8_function_map, 5},
+    {"_V8_write_array_buffer", (DL_FUNC) &_V8_write_array_buffer, 4},
+    {"_V8_context_expose", (DL_FUNC) &_V8_context_expose, 5},
+    {"_V8_context_assign", (DL_FUNC) &_V8_context_assign, 6},
+    {"_V8_context_serialize", (DL_FUNC) &_V8_context_serialize, 3},
+    {"_V8_context_deserialize", (DL_FUNC) &_V8_context_deserialize, 3},
+    {"_V8_context_wasm_module", (DL_FUNC) &_V8_context_wasm_module, 4},
+    {"_V8_context_memory_view", (DL_FUNC) &_V8_context_memory_view, 4},
+    {"_V8_context_memory_write", (DL_FUNC) &_V8_context_memory_write, 4},
     {"_V8_context_validate", (DL_FUNC) &_V8_context_validate, 2},
+    {"_V8_context_console_options", (DL_FUNC) &_V8_context_console_options, 3},
+    {"_V8_context_console_capture", (DL_FUNC) &_V8_context_console_capture, 2},
+    {"_V8_context_clear_timers", (DL_FUNC) &_V8_context_clear_timers, 1},
     {"_V8_context_null", (DL_FUNC) &_V8_context_null, 1},
-    {"_V8_make_context", (DL_FUNC) &_V8_make_context, 1},
+    {"_V8_write_snapshot", (DL_FUNC) &_V8_write_snapshot, 3},
+    {"_V8_make_context", (DL_FUNC) &_V8_make_context, 3},
+    {"_V8_pool_new", (DL_FUNC) &_V8_pool_new, 2},
+    {"_V8_pool_run", (DL_FUNC) &_V8_pool_run, 4},
+    {"_V8_pool_size", (DL_FUNC) &_V8_pool_size, 1},
+    {"_V8_pool_close", (DL_FUNC) &_V8_pool_close, 1},
     {NULL, NULL, 0}
 };
 
@@ -4,15 +4,67 @@
 #include <v8.h>
 
 #if (V8_MAJOR_VERSION * 100 + V8_MINOR_VERSION) >= 1001
-typedef v8::Global<v8::Context> ctx_type;
+typedef v8::Global<v8::Context> ctx_handle;
 #else
-typedef v8::Persistent<v8::Context> ctx_type;
+typedef v8::Persistent<v8::Context> ctx_handle;
 #endif
 
+/* A context along with the isolate it belongs to (contexts created from a
+ * startup snapshot or with a heap limit live in a separate isolate) */
+struct ctx_type {
+  v8::Isolate *isolate;
+  ctx_handle context;
+  bool owns_isolate; // isolate is disposed along with the context
+  ctx_type(v8::Isolate *isolate, v8::Local<v8::Context> context, bool owns_isolate = false) :
+    isolate(isolate), context(isolate, context), owns_isolate(owns_isolate) {}
+  v8::Local<v8::Context> Get() { return context.Get(isolate); }
+};
+
+/* A compiled JS function, for calling it repeatedly from R */
+struct fun_type {
+  v8::Isolate *isolate;
+  ctx_handle context;
+  v8::Global<v8::Function> fun;
+  v8::Global<v8::Value> receiver;
+  fun_type(v8::Isolate *isolate, v8::Local<v8::Context> context, v8::Local<v8::Function> fun) :
+    isolate(isolate), context(isolate, context), fun(isolate, fun) {}
+};
+
+/* A pending promise from an async evaluation, polled from the R event loop */
+struct promise_type {
+  v8::Isolate *isolate;
+  ctx_handle context;
+  v8::Global<v8::Promise> promise;
+  promise_type(v8::Isolate *isolate, v8::Local<v8::Context> context, v8::Local<v8::Promise> promise) :
+    isolate(isolate), context(isolate, context), promise(isolate, promise) {}
+};
+
+class isolate_pool;
+
 #else
 typedef int ctx_type;
+typedef int isolate_pool;
+typedef int promise_type;
 #endif // __EMSCRIPTEN__
 
 // typedef Rcpp::XPtr< ctx_type > v8_xptr;
 void ctx_finalizer(ctx_type* ctx);
 typedef Rcpp::XPtr< ctx_type, Rcpp::PreserveStorage, ctx_finalizer> ctxptr;
+
+void pool_finalizer(isolate_pool* pool);
+typedef Rcpp::XPtr< isolate_pool, Rcpp::PreserveStorage, pool_finalizer> poolptr;
+
+#ifdef __EMSCRIPTEN__
+/* WebR cannot hold on to JS objects, so the function is evaluated on each call */
+struct fun_type {
+  ctxptr ctx;
+  std::string src;
+  fun_type(ctxptr ctx, std::string src) : ctx(ctx), src(src) {}
+};
+#endif
+
+void fun_finalizer(fun_type* fun);
+typedef Rcpp::XPtr< fun_type, Rcpp::PreserveStorage, fun_finalizer> funptr;
+
+void promise_finalizer(promise_type* promise);
+typedef Rcpp::XPtr< promise_type, Rcpp::PreserveStorage, promise_finalizer> promiseptr;
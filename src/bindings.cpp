@@ -1,6 +1,14 @@
 #include <libplatform/libplatform.h>
 #include "V8_types.h"
 #include <fstream>
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 
 /* use conditional apis below */
 #define V8_VERSION_TOTAL (V8_MAJOR_VERSION * 100 + V8_MINOR_VERSION)
@@ -36,8 +44,55 @@
 /* used for setting icu data below */
 #ifdef __APPLE__
 #define V8_ICU_DATA_PATH "/usr/local/opt/v8/libexec/icudtl.dat"
+#endif
+
+/* getpid() is used for naming temporary cache files, getcwd() for resolving modules */
+#ifdef _WIN32
+#include <process.h>
+#include <direct.h>
+#define getpid _getpid
+#define getcwd _getcwd
+#else
 #include <unistd.h>
 #endif
+#include <sys/stat.h>
+
+/* NearHeapLimitCallback was added in V8 7.0 */
+#if V8_VERSION_TOTAL >= 700
+#define HAS_HEAP_LIMIT 1
+#endif
+
+/* CreateCodeCache() for an UnboundScript was added in V8 6.6 */
+#if V8_VERSION_TOTAL >= 606
+#define HAS_CODE_CACHE 1
+#endif
+
+/* Zero-copy buffers need the BackingStore API (V8 8.0) and ALTREP (R 3.6) */
+#if V8_VERSION_TOTAL >= 800 && R_VERSION >= R_Version(3, 6, 0)
+#define HAS_ZERO_COPY 1
+#include <R_ext/Altrep.h>
+#endif
+
+/* HasPendingBackgroundTasks() is used to poll pending async promises more often */
+#if V8_VERSION_TOTAL >= 900
+#define HAS_BACKGROUND_TASKS 1
+#endif
+
+/* ScriptCompiler::StreamedSource with a std::unique_ptr stream (V8 7.0) */
+#if V8_VERSION_TOTAL >= 700
+#define HAS_STREAMING 1
+#endif
+
+/* CompiledWasmModule can be serialized and shared between isolates (V8 8.4) */
+#if V8_VERSION_TOTAL >= 804
+#define HAS_WASM_CACHE 1
+#endif
+
+/* CpuProfiler::New() replaced Isolate::GetCpuProfiler() in V8 7.0 */
+#include <v8-profiler.h>
+#if V8_VERSION_TOTAL >= 700
+#define HAS_CPU_PROFILER 1
+#endif
 
 /* Note: Tov8::LocalChecked() aborts if x is empty */
 template <typename T>
@@ -45,24 +100,147 @@ v8::Local<T> safe_to_local(v8::MaybeLocal<T> x){
   return x.IsEmpty() ? v8::Local<T>() : x.ToLocalChecked();
 }
 
+static void dispose_isolate(v8::Isolate *isolate);
+static void clear_timers(v8::Isolate *isolate, ctx_type *context);
+static void clear_context_state(v8::Isolate *isolate, ctx_type *context);
+static void call_completed_cb(v8::Isolate *isolate);
+static void release_snapshot(ctx_type *context);
+
 void ctx_finalizer(ctx_type* context ){
-  if(context)
-    context->Reset();
+  if(context){
+    clear_timers(context->isolate, context);
+    clear_context_state(context->isolate, context);
+    context->context.Reset();
+    if(context->owns_isolate)
+      dispose_isolate(context->isolate);
+    release_snapshot(context);
+  }
   delete context;
 }
 
-static v8::Isolate* isolate = NULL;
+void fun_finalizer(fun_type* fun){
+  if(fun){
+    fun->fun.Reset();
+    fun->receiver.Reset();
+    fun->context.Reset();
+  }
+  delete fun;
+}
+
+void promise_finalizer(promise_type* promise){
+  if(promise){
+    promise->promise.Reset();
+    promise->context.Reset();
+  }
+  delete promise;
+}
+
+static v8::Isolate* main_isolate = NULL;
 static v8::Platform* platformptr = NULL;
 
-static std::string read_text(std::string filename) {
-  if(filename.empty() || (filename.at(0) != '.' && filename.at(0) != '/'))
-    throw std::runtime_error("Invalid module: " + filename + " (paths should begin with . or /)");
-  std::ifstream t(filename);
-  if(t.fail())
-    throw std::runtime_error("Failed to open file: " + filename);
-  std::stringstream buffer;
-  buffer << t.rdbuf();
-  return buffer.str();
+/* Large ASCII source files are exposed to V8 as external strings, such that the
+ * source text is never copied into the JS heap. The string is backed by a buffer
+ * that holds the file contents. V8 calls Dispose() when the string is garbage
+ * collected, which frees the buffer. A live mapping of the file is not used, as the
+ * file may be modified or truncated while V8 still references the string. */
+static const size_t external_source_min_size = 65536;
+
+class source_file : public v8::String::ExternalOneByteStringResource {
+  std::string buffer;
+public:
+  source_file(std::string filename){
+    std::ifstream input(filename, std::ios::binary | std::ios::ate);
+    if(input.fail())
+      throw std::runtime_error("Failed to open file: " + filename);
+    std::streamsize len = input.tellg();
+    if(len < 0)
+      throw std::runtime_error("Failed to read file: " + filename);
+    buffer.resize(len);
+    input.seekg(0);
+    if(len && !input.read(&buffer[0], len))
+      throw std::runtime_error("Failed to read file: " + filename);
+  }
+  const char* data() const { return buffer.data(); }
+  size_t length() const { return buffer.size(); }
+  bool is_ascii() const {
+    for(size_t i = 0; i < buffer.size(); i++){
+      if(buffer[i] & 0x80)
+        return false;
+    }
+    return true;
+  }
+};
+
+/* Reads a UTF-8 source file into a JS string, or an empty handle on failure */
+static v8::Local<v8::String> read_source(std::string filename){
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+  source_file *file = new source_file(filename);
+  if(file->length() >= external_source_min_size && file->is_ascii()){
+    v8::Local<v8::String> str = safe_to_local(v8::String::NewExternalOneByte(isolate, file));
+    if(str.IsEmpty())
+      delete file;
+    return str;
+  }
+  v8::Local<v8::String> str = safe_to_local(v8::String::NewFromUtf8(isolate, file->data(),
+                                                                    v8::NewStringType::kNormal, (int) file->length()));
+  delete file;
+  return str;
+}
+
+static bool is_absolute_path(const std::string &path){
+  return path.length() && (path.at(0) == '/' || path.at(0) == '\\' || (path.length() > 2 &&
+    isalpha(path.at(0)) && path.at(1) == ':' && (path.at(2) == '/' || path.at(2) == '\\')));
+}
+
+/* Lexically removes '.' and '..' segments from an absolute path */
+static std::string normalize_path(std::string path){
+  std::string out;
+  if(path.length() > 1 && path.at(1) == ':'){
+    out = path.substr(0, 2);
+    path = path.substr(2);
+  }
+  std::vector<std::string> parts;
+  size_t start = 0;
+  while(start <= path.length()){
+    size_t end = path.find_first_of("/\\", start);
+    if(end == std::string::npos)
+      end = path.length();
+    std::string part = path.substr(start, end - start);
+    if(part == ".."){
+      if(parts.size())
+        parts.pop_back();
+    } else if(part.length() && part != "."){
+      parts.push_back(part);
+    }
+    start = end + 1;
+  }
+  if(parts.empty())
+    return out + "/";
+  for(size_t i = 0; i < parts.size(); i++)
+    out += "/" + parts[i];
+  return out;
+}
+
+static std::string current_dir(){
+  char buf[4096];
+  return getcwd(buf, sizeof(buf)) ? std::string(buf) : std::string(".");
+}
+
+/* Resolves an import specifier to the absolute path of the module file. Relative
+ * specifiers are resolved against the importing module, and otherwise against the
+ * working directory, which is what earlier versions did for all imports. */
+static std::string resolve_module_path(std::string specifier, std::string referrer){
+  if(specifier.empty() || (specifier.at(0) != '.' && specifier.at(0) != '/'))
+    throw std::runtime_error("Invalid module: " + specifier + " (paths should begin with . or /)");
+  if(is_absolute_path(specifier))
+    return normalize_path(specifier);
+  if(is_absolute_path(referrer)){
+    size_t pos = referrer.find_last_of("/\\");
+    std::string path = normalize_path(referrer.substr(0, pos) + "/" + specifier);
+    if(std::ifstream(path).good())
+      return path;
+  }
+  return normalize_path(current_dir() + "/" + specifier);
 }
 
 // Extracts a C string from a V8 Utf8Value.
@@ -71,12 +249,12 @@ static const char* ToCString(const v8::String::Utf8Value& value) {
 }
 
 static v8::Local<v8::String> ToJSString(const char * str){
-  v8::MaybeLocal<v8::String> out = v8::String::NewFromUtf8(isolate, str, v8::NewStringType::kNormal);
+  v8::MaybeLocal<v8::String> out = v8::String::NewFromUtf8(v8::Isolate::GetCurrent(), str, v8::NewStringType::kNormal);
   return safe_to_local(out);
 }
 
 static void message_cb(v8::Local<v8::Message> message, v8::Local<v8::Value> data){
-  v8::String::Utf8Value str(isolate, message->Get());
+  v8::String::Utf8Value str(v8::Isolate::GetCurrent(), message->Get());
   REprintf("V8 MESSAGE (level %d): %s", message->ErrorLevel(), ToCString(str));
 }
 
@@ -84,8 +262,17 @@ static void fatal_cb(const char* location, const char* message){
   REprintf("V8 FATAL ERROR in %s: %s", location, message);
 }
 
-static v8::Local<v8::Module> read_module(std::string filename, v8::Local<v8::Context> context);
+static v8::Local<v8::Module> read_module(std::string path, v8::Local<v8::Context> context);
+static v8::Local<v8::Module> compile_module(std::string path, v8::Local<v8::Context> context);
+static v8::Local<v8::Module> cached_module(v8::Local<v8::Context> context, std::string path);
+static std::string cached_module_path(v8::Local<v8::Context> context, v8::Local<v8::Module> module);
+static void cache_module(v8::Local<v8::Context> context, std::string path, v8::Local<v8::Module> module);
+static void uncache_failed_modules(v8::Local<v8::Context> context);
+#ifdef HAS_WASM_CACHE
+static void wasm_streaming_cb(const v8::FunctionCallbackInfo<v8::Value>& args);
+#endif
 
+/* Static imports are only compiled here; V8 instantiates and evaluates the graph */
 static v8::MaybeLocal<v8::Module> ResolveModuleCallback(v8::Local<v8::Context> context, v8::Local<v8::String> specifier
                                                         FixedArrayParam, v8::Local<v8::Module> referrer) {
 #if V8_VERSION_TOTAL >= 1402
@@ -94,24 +281,25 @@ static v8::MaybeLocal<v8::Module> ResolveModuleCallback(v8::Local<v8::Context> c
   v8::String::Utf8Value name(context->GetIsolate(), specifier);
 #endif
   try {
-    return read_module(*name, context);
+    return compile_module(resolve_module_path(*name, cached_module_path(context, referrer)), context);
   }
   catch(const std::exception& err) {
-    isolate->ThrowException(ToJSString(err.what()));
+    v8::Isolate::GetCurrent()->ThrowException(ToJSString(err.what()));
   }
   return v8::Local<v8::Module>();
 }
 
-static v8::MaybeLocal<v8::Promise> dynamic_module_loader(v8::Local<v8::Context> context, v8::Local<v8::String> specifier) {
+static v8::MaybeLocal<v8::Promise> dynamic_module_loader(v8::Local<v8::Context> context, v8::Local<v8::String> specifier,
+                                                         v8::Local<v8::Value> referrer) {
   v8::Local<v8::Promise::Resolver> resolver = v8::Promise::Resolver::New(context).ToLocalChecked();
   v8::MaybeLocal<v8::Promise> promise(resolver->GetPromise());
-#if V8_VERSION_TOTAL >= 1402
-  v8::String::Utf8Value name(v8::Isolate::GetCurrent(), specifier);
-#else
-  v8::String::Utf8Value name(context->GetIsolate(), specifier);
-#endif
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+  v8::String::Utf8Value name(isolate, specifier);
+  std::string referrer_path;
+  if(!referrer.IsEmpty() && referrer->IsString())
+    referrer_path = *v8::String::Utf8Value(isolate, referrer);
   try {
-    v8::Local<v8::Module> module = read_module(*name, context);
+    v8::Local<v8::Module> module = read_module(resolve_module_path(*name, referrer_path), context);
     resolver->Resolve(context, module->GetModuleNamespace()).FromMaybe(false);
   } catch(const std::exception& err) {
     resolver->Reject(context, ToJSString(err.what())).FromMaybe(false);
@@ -134,55 +322,575 @@ static v8::MaybeLocal<v8::Promise> ResolveDynamicModuleCallback(
     v8::Local<v8::String> specifier
     FixedArrayParam
 ) {
-  return dynamic_module_loader(context, specifier);
+#if V8_VERSION_TOTAL >= 908
+  return dynamic_module_loader(context, specifier, resource_name);
+#elif V8_VERSION_TOTAL >= 603
+  return dynamic_module_loader(context, specifier, referrer->GetResourceName());
+#else
+  return dynamic_module_loader(context, specifier, referrer);
+#endif
 }
 
-static v8::ScriptOrigin make_origin(std::string filename){
+static v8::ScriptOrigin make_origin(std::string filename, bool is_module = true){
 #if V8_VERSION_TOTAL < 908 || NODEJS_LTS_API == 16
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
   return v8::ScriptOrigin(ToJSString( filename.c_str()), v8::Integer::New(isolate, 0),
                           v8::Integer::New(isolate, 0), v8::False(isolate), v8::Local<v8::Integer>(),
-                          v8::Local<v8::Value>(), v8::False(isolate), v8::False(isolate), v8::True(isolate));
+                          v8::Local<v8::Value>(), v8::False(isolate), v8::False(isolate), v8::Boolean::New(isolate, is_module));
 #elif V8_VERSION_TOTAL < 1201
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
   return v8::ScriptOrigin(isolate,ToJSString( filename.c_str()), 0, 0, false, -1,
-                          v8::Local<v8::Value>(), false, false, true);
+                          v8::Local<v8::Value>(), false, false, is_module);
 #else
   return v8::ScriptOrigin(ToJSString( filename.c_str()), 0, 0, false, -1,
-                          v8::Local<v8::Value>(), false, false, true);
+                          v8::Local<v8::Value>(), false, false, is_module);
 #endif
 }
 
 static std::string throw_js_err(v8::Local<v8::Value> Exception, std::string filename){
-  std::string errmsg(std::string("Failed to import ES module '") + filename + "': " + *v8::String::Utf8Value(isolate, Exception));
+  std::string errmsg(std::string("Failed to import ES module '") + filename + "': " + *v8::String::Utf8Value(v8::Isolate::GetCurrent(), Exception));
   throw std::runtime_error(errmsg);
 }
 
-/* Helper fun that compiles JavaScript source code */
-static v8::Local<v8::Module> read_module(std::string filename, v8::Local<v8::Context> context){
-  v8::Local<v8::String> source_text = ToJSString(read_text(filename).c_str());
+/* Compiles a module, unless it was already loaded in this context */
+static v8::Local<v8::Module> compile_module(std::string path, v8::Local<v8::Context> context){
+  v8::Local<v8::Module> module = cached_module(context, path);
+  if(!module.IsEmpty())
+    return module;
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+  v8::Local<v8::String> source_text = read_source(path);
   if(source_text.IsEmpty())
     throw std::runtime_error("Failed to read module file (check memory/stack limits.");
   v8::TryCatch trycatch(isolate);
-  v8::ScriptCompiler::Source source(source_text, make_origin(filename));
-  v8::Local<v8::Module> module;
+  v8::ScriptCompiler::Source source(source_text, make_origin(path));
   if (!v8::ScriptCompiler::CompileModule(isolate, &source).ToLocal(&module)){
     if(trycatch.HasCaught())
-      throw_js_err(trycatch.Exception(), filename);
+      throw_js_err(trycatch.Exception(), path);
     throw std::runtime_error("Failed to run CompileModule() source.");
   }
-  if(!module->InstantiateModule(context, ResolveModuleCallback).FromMaybe(false)){
+  cache_module(context, path, module);
+  return module;
+}
+
+/* Loads a module and its imports, and evaluates it if this did not happen before */
+static v8::Local<v8::Module> read_module(std::string path, v8::Local<v8::Context> context){
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+  v8::Local<v8::Module> module = compile_module(path, context);
+  v8::TryCatch trycatch(isolate);
+  if(module->GetStatus() == v8::Module::kUninstantiated &&
+     !module->InstantiateModule(context, ResolveModuleCallback).FromMaybe(false)){
     if(trycatch.HasCaught())
-      throw_js_err(trycatch.Exception(), filename);
+      throw_js_err(trycatch.Exception(), path);
     throw std::runtime_error("Failed to run InstantiateModule().");
   }
   v8::Local<v8::Value> retValue;
   if (!module->Evaluate(context).ToLocal(&retValue)){
+    uncache_failed_modules(context);
     if(trycatch.HasCaught())
-      throw_js_err(trycatch.Exception(), filename);
+      throw_js_err(trycatch.Exception(), path);
     throw std::runtime_error("Failure loading module");
   }
+  if(retValue->IsPromise() && retValue.As<v8::Promise>()->State() == v8::Promise::kRejected){
+    uncache_failed_modules(context);
+    throw_js_err(retValue.As<v8::Promise>()->Result(), path);
+  }
   return module;
 }
 
+/* Sets callbacks and limits on a newly created isolate */
+static void setup_isolate(v8::Isolate *isolate){
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+
+  isolate->AddMessageListener(message_cb);
+  isolate->SetFatalErrorHandler(fatal_cb);
+
+#ifdef __SANITIZE_ADDRESS__
+  /* Disable stack limit when using sanitizers (highest possible value, backwards) */
+  isolate->SetStackLimit(1);
+#else
+  /* Workaround for packages hitting stack limit on Fedora, such as ggdag.
+   * CurrentStackPosition trick copied from chromium. */
+  static const int kWorkerMaxStackSize = 2000 * 1024;
+  uintptr_t CurrentStackPosition = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  isolate->SetStackLimit(CurrentStackPosition - kWorkerMaxStackSize);
+#endif
+  isolate->SetHostImportModuleDynamicallyCallback(ResolveDynamicModuleCallback);
+#ifdef HAS_WASM_CACHE
+  isolate->SetWasmStreamingCallback(wasm_streaming_cb);
+#endif
+}
+
+/* GC pauses on the main thread, see isolate_track_gc() */
+static const int gc_types = 5;
+static const int gc_bins = 10;
+static const double gc_breaks[gc_bins - 1] = {1, 2, 5, 10, 20, 50, 100, 200, 500};
+
+typedef struct {
+  bool enabled;
+  int depth;
+  std::chrono::steady_clock::time_point start;
+  double count[gc_types];
+  double time[gc_types];
+  double max;
+  double histogram[gc_bins];
+} gc_state;
+
+/* A pending setTimeout() or setInterval() callback */
+typedef struct {
+  double due;       // on the steady clock, in ms
+  double interval;  // in ms, or negative for a one-off timeout
+  v8::Global<v8::Context> context;
+  v8::Global<v8::Function> fun;
+  std::vector<v8::Global<v8::Value>> args;
+} js_timer;
+
+/* Levels of console output, see ConsoleLog() */
+enum console_level { console_debug, console_info, console_warn, console_none };
+
+/* An R function that is exposed as a JavaScript function, see context_expose() */
+typedef struct r_function {
+  Rcpp::Function fun;
+  bool auto_unbox;
+  bool simplify;
+  r_function(Rcpp::Function fun, bool auto_unbox, bool simplify) :
+    fun(fun), auto_unbox(auto_unbox), simplify(simplify) {}
+} r_function;
+
+/* Per-context state: the ES modules loaded in the context by absolute path, console
+ * output that has not been written yet, and the exposed R functions */
+typedef struct {
+  v8::Global<v8::Context> context;
+  std::map<std::string, v8::Global<v8::Module>> modules;
+  std::multimap<int, std::string> paths;  // by identity hash of the module
+  int console_level;                      // messages below this level are dropped
+  bool console_capture;                   // keep output for ct$eval(capture = TRUE)
+  Rcpp::RObject console_sink;             // a connection, or NULL for the R console
+  std::vector<std::pair<int, std::string>> console;
+  size_t console_size;
+  std::map<std::string, r_function> functions; // by name, referenced by v8::External data
+} context_state;
+
+/* Per-isolate state, stored in slot 0 of each isolate on the main thread */
+typedef struct {
+  size_t initial_limit;
+  bool exceeded;
+  gc_state gc;
+  v8::CpuProfiler *profiler;
+  std::map<int, js_timer*> timers;
+  int timer_count;
+  std::vector<context_state*> contexts;
+} isolate_state;
+
+/* When the heap limit is reached, V8 would normally crash the process. Instead
+ * we terminate the running script, and temporarily raise the limit such that
+ * the stack can unwind. The error is then raised by check_heap_limit(). */
+#ifdef HAS_HEAP_LIMIT
+static size_t near_heap_limit_cb(void *data, size_t current_heap_limit, size_t initial_heap_limit){
+  v8::Isolate *isolate = (v8::Isolate *) data;
+  isolate_state *state = (isolate_state *) isolate->GetData(0);
+  state->initial_limit = initial_heap_limit;
+  state->exceeded = true;
+  isolate->TerminateExecution();
+  return current_heap_limit + initial_heap_limit / 4;
+}
+#endif
+
+static void check_heap_limit(v8::Isolate *isolate){
+  isolate_state *state = (isolate_state *) isolate->GetData(0);
+  if(!state || !state->exceeded)
+    return;
+  state->exceeded = false;
+  isolate->CancelTerminateExecution();
+#ifdef HAS_HEAP_LIMIT
+  // Restores the initial limit
+  isolate->RemoveNearHeapLimitCallback(near_heap_limit_cb, state->initial_limit);
+  isolate->AddNearHeapLimitCallback(near_heap_limit_cb, isolate);
+#endif
+  isolate->LowMemoryNotification();
+  char msg[100];
+  snprintf(msg, sizeof(msg), "JavaScript heap limit of %d MB exceeded", (int) (state->initial_limit >> 20));
+  throw std::runtime_error(msg);
+}
+
+static const intptr_t * external_references();
+
+/* All isolates on the main thread share an allocator */
+static v8::ArrayBuffer::Allocator * main_allocator(){
+  static v8::ArrayBuffer::Allocator *allocator = v8::ArrayBuffer::Allocator::NewDefaultAllocator();
+  return allocator;
+}
+
+/* Sets the maximum heap size (in MB) of a new isolate, or keeps the default if 0 */
+static void set_heap_limit(v8::Isolate::CreateParams &create_params, double heap_limit){
+  if(heap_limit > 0){
+#if V8_VERSION_TOTAL >= 803
+    create_params.constraints.ConfigureDefaultsFromHeapSize(0, heap_limit * 1024 * 1024);
+#else
+    create_params.constraints.set_max_old_space_size(heap_limit);
+#endif
+  }
+}
+
+/* Creates an isolate, optionally deserialized from a startup snapshot,
+ * and with a custom heap limit (in MB) */
+static v8::Isolate * new_isolate(v8::StartupData *snapshot, double heap_limit = 0){
+  v8::Isolate::CreateParams create_params;
+  create_params.array_buffer_allocator = main_allocator();
+  if(snapshot){
+    create_params.snapshot_blob = snapshot;
+    create_params.external_references = external_references();
+  }
+  set_heap_limit(create_params, heap_limit);
+  v8::Isolate *isolate = v8::Isolate::New(create_params);
+  if(!isolate)
+    throw std::runtime_error("Failed to initiate V8 isolate");
+  setup_isolate(isolate);
+  isolate->SetData(0, new isolate_state());
+  isolate->AddCallCompletedCallback(call_completed_cb);
+#ifdef HAS_HEAP_LIMIT
+  isolate->AddNearHeapLimitCallback(near_heap_limit_cb, isolate);
+#endif
+  return isolate;
+}
+
+static int gc_type_index(v8::GCType type){
+  switch(type){
+  case v8::kGCTypeScavenge: return 0;
+  case v8::kGCTypeMarkSweepCompact: return 1;
+  case v8::kGCTypeIncrementalMarking: return 2;
+  case v8::kGCTypeProcessWeakCallbacks: return 3;
+  default: return 4;
+  }
+}
+
+static void gc_prologue_cb(v8::Isolate *isolate, v8::GCType type, v8::GCCallbackFlags flags){
+  isolate_state *state = (isolate_state *) isolate->GetData(0);
+  if(state && state->gc.depth++ == 0)
+    state->gc.start = std::chrono::steady_clock::now();
+}
+
+static void gc_epilogue_cb(v8::Isolate *isolate, v8::GCType type, v8::GCCallbackFlags flags){
+  isolate_state *state = (isolate_state *) isolate->GetData(0);
+  if(!state || state->gc.depth == 0 || --state->gc.depth > 0)
+    return;
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - state->gc.start).count();
+  int i = gc_type_index(type);
+  state->gc.count[i]++;
+  state->gc.time[i] += ms;
+  state->gc.max = std::max(state->gc.max, ms);
+  int bin = 0;
+  while(bin < gc_bins - 1 && ms >= gc_breaks[bin])
+    bin++;
+  state->gc.histogram[bin]++;
+}
+
+static void dispose_isolate(v8::Isolate *isolate){
+  clear_timers(isolate, NULL);
+  clear_context_state(isolate, NULL);
+  isolate_state *state = (isolate_state *) isolate->GetData(0);
+#ifdef HAS_CPU_PROFILER
+  if(state && state->profiler)
+    state->profiler->Dispose();
+#endif
+  delete state;
+  isolate->SetData(0, NULL);
+  isolate->Dispose();
+}
+
+/* Timers: setTimeout() and setInterval() callbacks are queued per isolate, and run
+ * by run_timers() while waiting for a promise, or when polling an async evaluation.
+ * Timers are not available in the isolate pool. */
+static double now_ms(){
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void set_timer(const v8::FunctionCallbackInfo<v8::Value>& args, bool repeat){
+  v8::Isolate *isolate = args.GetIsolate();
+  isolate_state *state = (isolate_state *) isolate->GetData(0);
+  if(!state){
+    isolate->ThrowException(ToJSString("Timers are not supported in this isolate"));
+    return;
+  }
+  if(args.Length() < 1 || !args[0]->IsFunction()){
+    isolate->ThrowException(v8::Exception::TypeError(ToJSString("Timer callback must be a function")));
+    return;
+  }
+  v8::Local<v8::Context> context = isolate->GetCurrentContext();
+  double delay = args.Length() > 1 ? args[1]->NumberValue(context).FromMaybe(0) : 0;
+  if(!(delay > 0))
+    delay = 0;
+  js_timer *timer = new js_timer();
+  timer->due = now_ms() + delay;
+  timer->interval = repeat ? std::max(delay, 1.0) : -1;
+  timer->context.Reset(isolate, context);
+  timer->fun.Reset(isolate, args[0].As<v8::Function>());
+  for(int i = 2; i < args.Length(); i++)
+    timer->args.emplace_back(isolate, args[i]);
+  int id = ++state->timer_count;
+  state->timers[id] = timer;
+  args.GetReturnValue().Set(id);
+}
+
+static void delete_timer(js_timer *timer){
+  timer->context.Reset();
+  timer->fun.Reset();
+  for(size_t i = 0; i < timer->args.size(); i++)
+    timer->args[i].Reset();
+  delete timer;
+}
+
+/* setTimeout(fun, delay, ...args) */
+static void GlobalSetTimeout(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  set_timer(args, false);
+}
+
+/* setInterval(fun, delay, ...args) */
+static void GlobalSetInterval(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  set_timer(args, true);
+}
+
+/* clearTimeout(id) and clearInterval(id) */
+static void GlobalClearTimer(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  v8::Isolate *isolate = args.GetIsolate();
+  isolate_state *state = (isolate_state *) isolate->GetData(0);
+  if(!state || args.Length() < 1 || !args[0]->IsNumber())
+    return;
+  int id = args[0]->Int32Value(isolate->GetCurrentContext()).FromMaybe(0);
+  std::map<int, js_timer*>::iterator it = state->timers.find(id);
+  if(it != state->timers.end()){
+    delete_timer(it->second);
+    state->timers.erase(it);
+  }
+}
+
+/* queueMicrotask(fun) */
+static void GlobalQueueMicrotask(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  v8::Isolate *isolate = args.GetIsolate();
+  if(args.Length() < 1 || !args[0]->IsFunction()){
+    isolate->ThrowException(v8::Exception::TypeError(ToJSString("Microtask callback must be a function")));
+    return;
+  }
+  isolate->EnqueueMicrotask(args[0].As<v8::Function>());
+}
+
+/* Removes the timers of a context, or all timers if context is NULL */
+static void clear_timers(v8::Isolate *isolate, ctx_type *context){
+  isolate_state *state = (isolate_state *) isolate->GetData(0);
+  if(!state)
+    return;
+  std::map<int, js_timer*>::iterator it = state->timers.begin();
+  while(it != state->timers.end()){
+    if(!context || it->second->context == context->context){
+      delete_timer(it->second);
+      it = state->timers.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+/* State of a context on the main thread. Isolates without state (the pool and the
+ * snapshot creator) do not cache modules, and write console output directly. */
+static context_state* get_context_state(v8::Local<v8::Context> context, bool create){
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+  isolate_state *state = (isolate_state *) isolate->GetData(0);
+  if(!state)
+    return NULL;
+  for(size_t i = 0; i < state->contexts.size(); i++){
+    if(state->contexts[i]->context == context)
+      return state->contexts[i];
+  }
+  if(!create)
+    return NULL;
+  context_state *cs = new context_state();
+  cs->context.Reset(isolate, context);
+  state->contexts.push_back(cs);
+  return cs;
+}
+
+/* The module registry makes sure that every module is loaded once per context,
+ * also when it is imported from several places. */
+static v8::Local<v8::Module> cached_module(v8::Local<v8::Context> context, std::string path){
+  context_state *registry = get_context_state(context, false);
+  if(registry){
+    std::map<std::string, v8::Global<v8::Module>>::iterator it = registry->modules.find(path);
+    if(it != registry->modules.end())
+      return it->second.Get(v8::Isolate::GetCurrent());
+  }
+  return v8::Local<v8::Module>();
+}
+
+/* Path of a loaded module, or an empty string if it is not in the registry */
+static std::string cached_module_path(v8::Local<v8::Context> context, v8::Local<v8::Module> module){
+  context_state *registry = get_context_state(context, false);
+  if(!registry || module.IsEmpty())
+    return "";
+  typedef std::multimap<int, std::string>::iterator path_iterator;
+  std::pair<path_iterator, path_iterator> range = registry->paths.equal_range(module->GetIdentityHash());
+  for(path_iterator it = range.first; it != range.second; it++){
+    if(registry->modules[it->second] == module)
+      return it->second;
+  }
+  return "";
+}
+
+static void cache_module(v8::Local<v8::Context> context, std::string path, v8::Local<v8::Module> module){
+  context_state *registry = get_context_state(context, true);
+  if(!registry)
+    return;
+  registry->modules[path].Reset(v8::Isolate::GetCurrent(), module);
+  registry->paths.insert(std::make_pair(module->GetIdentityHash(), path));
+}
+
+/* Drops modules that failed to evaluate, such that a fixed file can be imported again */
+static void uncache_failed_modules(v8::Local<v8::Context> context){
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+  context_state *registry = get_context_state(context, false);
+  if(!registry)
+    return;
+  std::multimap<int, std::string>::iterator it = registry->paths.begin();
+  while(it != registry->paths.end()){
+    v8::Global<v8::Module> &module = registry->modules[it->second];
+    if(module.Get(isolate)->GetStatus() == v8::Module::kErrored){
+      registry->modules.erase(it->second);
+      it = registry->paths.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+/* Removes the state of a context, or of all contexts if context is NULL */
+static void clear_context_state(v8::Isolate *isolate, ctx_type *context){
+  isolate_state *state = (isolate_state *) isolate->GetData(0);
+  if(!state)
+    return;
+  std::vector<context_state*>::iterator it = state->contexts.begin();
+  while(it != state->contexts.end()){
+    if(!context || (*it)->context == context->context){
+      delete *it;
+      it = state->contexts.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+/* Console output is buffered per context, and written in batches when the outermost
+ * call returns, while waiting for promises, before calling back into R, or when the
+ * buffer gets large. Output is kept in the buffer while it is being captured. */
+static const size_t console_buffer_size = 65536;
+
+static std::string console_line(const std::pair<int, std::string> &line){
+  return line.first == console_warn ? "Warning: " + line.second : line.second;
+}
+
+static void flush_console(context_state *cs){
+  if(cs->console.empty() || cs->console_capture)
+    return;
+  std::vector<std::pair<int, std::string>> lines;
+  lines.swap(cs->console);
+  cs->console_size = 0;
+  if(!Rf_isNull(cs->console_sink)){
+    Rcpp::CharacterVector text(lines.size());
+    for(size_t i = 0; i < lines.size(); i++)
+      text[i] = Rcpp::String(console_line(lines[i]), CE_UTF8);
+    try {
+      Rcpp::Function write_lines = Rcpp::Environment::namespace_env("base")["writeLines"];
+      write_lines(text, cs->console_sink);
+    } catch(const std::exception &e) {
+      REprintf("Failed to write console output: %s\n", e.what());
+    }
+    return;
+  }
+  std::string out;
+  for(size_t i = 0; i < lines.size(); i++){
+    if(lines[i].first == console_warn){
+      if(out.length())
+        Rprintf("%s", out.c_str());
+      out.clear();
+      Rf_warningcall_immediate(R_NilValue, "%s", lines[i].second.c_str());
+    } else {
+      out += lines[i].second + "\n";
+    }
+  }
+  if(out.length())
+    Rprintf("%s", out.c_str());
+}
+
+static void flush_console(v8::Isolate *isolate){
+  isolate_state *state = (isolate_state *) isolate->GetData(0);
+  if(!state)
+    return;
+  for(size_t i = 0; i < state->contexts.size(); i++)
+    flush_console(state->contexts[i]);
+}
+
+/* Called by V8 when the outermost script or function call returns */
+static void call_completed_cb(v8::Isolate *isolate){
+  flush_console(isolate);
+}
+
+/* Time in ms until the next timer is due, or -1 if there are no timers */
+static double next_timer(v8::Isolate *isolate){
+  isolate_state *state = (isolate_state *) isolate->GetData(0);
+  if(!state || state->timers.empty())
+    return -1;
+  double due = INFINITY;
+  for(std::map<int, js_timer*>::iterator it = state->timers.begin(); it != state->timers.end(); it++)
+    due = std::min(due, it->second->due);
+  return std::max(due - now_ms(), 0.0);
+}
+
+/* Runs the timers that are due, in order. Timers that are created or rescheduled
+ * by the callbacks run in a later call. Uncaught errors are printed, like in a
+ * browser. Returns true if any timers were run. */
+static bool run_timers(v8::Isolate *isolate){
+  isolate_state *state = (isolate_state *) isolate->GetData(0);
+  if(!state)
+    return false;
+  double now = now_ms();
+  int last_id = state->timer_count;
+  bool ran = false;
+  while(!isolate->IsExecutionTerminating()){
+    std::map<int, js_timer*>::iterator next = state->timers.end();
+    for(std::map<int, js_timer*>::iterator it = state->timers.begin(); it != state->timers.end(); it++){
+      if(it->first <= last_id && it->second->due <= now && (next == state->timers.end() || it->second->due < next->second->due))
+        next = it;
+    }
+    if(next == state->timers.end())
+      break;
+    js_timer *timer = next->second;
+    bool once = timer->interval < 0;
+    if(once){
+      state->timers.erase(next);
+    } else {
+      timer->due = now_ms() + timer->interval;
+    }
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = timer->context.Get(isolate);
+    v8::Context::Scope context_scope(context);
+    v8::Local<v8::Function> fun = timer->fun.Get(isolate);
+    std::vector<v8::Local<v8::Value>> argv;
+    for(size_t i = 0; i < timer->args.size(); i++)
+      argv.push_back(timer->args[i].Get(isolate));
+    if(once)
+      delete_timer(timer);
+    v8::TryCatch trycatch(isolate);
+    if(fun->Call(context, context->Global(), argv.size(), argv.data()).IsEmpty() && !trycatch.HasTerminated()){
+      v8::String::Utf8Value exception(isolate, trycatch.Exception());
+      REprintf("Uncaught error in timer: %s\n", ToCString(exception));
+    }
+    isolate->PerformMicrotaskCheckpoint();
+    ran = true;
+  }
+  return ran;
+}
+
+#ifdef HAS_ZERO_COPY
+static void register_buffer_view(DllInfo *dll);
+#endif
 
 // [[Rcpp::init]]
 void start_v8_isolate(void *dll){
@@ -210,30 +918,10 @@ void start_v8_isolate(void *dll){
   v8::V8::SetFlagsFromString("--experimental-wasm-reftypes");
 #endif
   v8::V8::Initialize();
-  v8::Isolate::CreateParams create_params;
-  create_params.array_buffer_allocator =
-    v8::ArrayBuffer::Allocator::NewDefaultAllocator();
-  isolate = v8::Isolate::New(create_params);
-  if(!isolate)
-    throw std::runtime_error("Failed to initiate V8 isolate");
-
-  v8::Isolate::Scope isolate_scope(isolate);
-  v8::HandleScope handle_scope(isolate);
-
-  isolate->AddMessageListener(message_cb);
-  isolate->SetFatalErrorHandler(fatal_cb);
-
-#ifdef __SANITIZE_ADDRESS__
-  /* Disable stack limit when using sanitizers (highest possible value, backwards) */
-  isolate->SetStackLimit(1);
-#else
-  /* Workaround for packages hitting stack limit on Fedora, such as ggdag.
-   * CurrentStackPosition trick copied from chromium. */
-  static const int kWorkerMaxStackSize = 2000 * 1024;
-  uintptr_t CurrentStackPosition = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
-  isolate->SetStackLimit(CurrentStackPosition - kWorkerMaxStackSize);
+  main_isolate = new_isolate(NULL);
+#ifdef HAS_ZERO_COPY
+  register_buffer_view((DllInfo *) dll);
 #endif
-  isolate->SetHostImportModuleDynamicallyCallback(ResolveDynamicModuleCallback);
 }
 
 /* Helper fun that compiles JavaScript source code */
@@ -246,9 +934,165 @@ static v8::Local<v8::Script> compile_source(std::string src, v8::Local<v8::Conte
   return safe_to_local(script);
 }
 
+/* Code cache: small scripts are not worth a disk roundtrip */
+static const size_t code_cache_min_size = 1024;
+
+static uint64_t fnv_hash(const unsigned char *data, size_t length){
+  uint64_t hash = 14695981039346656037ULL; //FNV-1a
+  for(size_t i = 0; i < length; i++){
+    hash ^= data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+/* Cache files are keyed by a hash of the source and the V8 version/flags tag */
+static std::string code_cache_path(std::string dir, const std::string & src){
+  uint64_t hash = fnv_hash((const unsigned char *) src.data(), src.size());
+  char key[64];
+#ifdef HAS_CODE_CACHE
+  uint32_t tag = v8::ScriptCompiler::CachedDataVersionTag();
+#else
+  uint32_t tag = 0;
+#endif
+  snprintf(key, sizeof(key), "%016llx-%lx-%08x.jsc", (unsigned long long) hash, (unsigned long) src.size(), tag);
+  return dir + "/" + key;
+}
+
+#ifdef HAS_CODE_CACHE
+static v8::ScriptCompiler::CachedData * read_code_cache(std::string path){
+  std::ifstream input(path, std::ios::binary | std::ios::ate);
+  if(input.fail())
+    return NULL;
+  std::streamsize len = input.tellg();
+  if(len <= 0)
+    return NULL;
+  uint8_t *buf = new uint8_t[len];
+  input.seekg(0);
+  if(!input.read(reinterpret_cast<char*>(buf), len)){
+    delete[] buf;
+    return NULL;
+  }
+  return new v8::ScriptCompiler::CachedData(buf, len, v8::ScriptCompiler::CachedData::BufferOwned);
+}
+
+/* Write to a tempfile first, so that concurrent R processes never see a partial file */
+static void write_cache_file(std::string path, const uint8_t *data, size_t length){
+  std::string tmp = path + ".tmp" + std::to_string(getpid());
+  std::ofstream output(tmp, std::ios::binary);
+  output.write(reinterpret_cast<const char*>(data), length);
+  output.close();
+  if(output.fail()){
+    std::remove(tmp.c_str());
+  } else if(std::rename(tmp.c_str(), path.c_str())){
+    // Windows does not overwrite existing files
+    std::remove(path.c_str());
+    if(std::rename(tmp.c_str(), path.c_str()))
+      std::remove(tmp.c_str());
+  }
+}
+
+static void write_code_cache(std::string path, v8::Local<v8::Script> script){
+  std::unique_ptr<v8::ScriptCompiler::CachedData> data(v8::ScriptCompiler::CreateCodeCache(script->GetUnboundScript()));
+  if(!data || data->length <= 0)
+    return;
+  write_cache_file(path, data->data, data->length);
+}
+#endif
+
+/* Same as compile_source() but consumes a cached file if available.
+ * Sets 'stale' if the cache is missing or was rejected by V8 and needs to be (re)written. */
+static v8::Local<v8::Script> compile_cached(std::string src, v8::Local<v8::Context> context, std::string path, bool *stale){
+#ifdef HAS_CODE_CACHE
+  v8::Local<v8::String> source_text = ToJSString(src.c_str());
+  if(source_text.IsEmpty()){
+    throw std::runtime_error("Failed to load JavaScript source. Check memory/stack limits.");
+  }
+  v8::ScriptCompiler::CachedData *cached = read_code_cache(path);
+  v8::ScriptCompiler::Source source(source_text, cached); //takes ownership of cached
+  v8::ScriptCompiler::CompileOptions options = cached ?
+    v8::ScriptCompiler::kConsumeCodeCache : v8::ScriptCompiler::kNoCompileOptions;
+  v8::Local<v8::Script> script = safe_to_local(v8::ScriptCompiler::Compile(context, &source, options));
+  *stale = !cached || source.GetCachedData()->rejected;
+  return script;
+#else
+  *stale = false;
+  return compile_source(src, context);
+#endif
+}
+
+/* Posted to the foreground task queue to wake up a blocking PumpMessageLoop() */
+class wakeup_task : public v8::Task {
+public:
+  void Run(){}
+};
+
+/* Posts a wakeup task at a regular interval from a separate thread, while alive */
+class wakeup_timer {
+  std::shared_ptr<v8::TaskRunner> runner;
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done = false;
+  std::thread thread;
+public:
+  wakeup_timer(v8::Isolate *isolate, int interval_ms) : runner(platformptr->GetForegroundTaskRunner(isolate)) {
+    thread = std::thread([this, interval_ms]{
+      std::unique_lock<std::mutex> lock(mutex);
+      while(!cv.wait_for(lock, std::chrono::milliseconds(interval_ms), [this]{ return done; }))
+        runner->PostTask(std::unique_ptr<v8::Task>(new wakeup_task()));
+    });
+  }
+  ~wakeup_timer(){
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done = true;
+    }
+    cv.notify_all();
+    thread.join();
+  }
+};
+
+/* Runs foreground tasks, microtasks and timers while waiting for a promise. If the
+ * previous call found nothing to do, it first waits for work: it sleeps until the next
+ * timer if that is due within 100ms, and otherwise blocks on the task queue until a
+ * task is posted, e.g. by a background thread. In all cases it returns at least
+ * every 100ms such that the caller can check for interrupts. */
+class task_waiter {
+  v8::Isolate *isolate;
+  bool idle = false;
+  std::unique_ptr<wakeup_timer> timer;
+public:
+  task_waiter(v8::Isolate *isolate) : isolate(isolate) {}
+  void run(){
+    if(idle)
+      wait();
+    idle = true;
+    while(v8::platform::PumpMessageLoop(platformptr, isolate, v8::platform::MessageLoopBehavior::kDoNotWait))
+      idle = false;
+    isolate->PerformMicrotaskCheckpoint();
+    if(run_timers(isolate))
+      idle = false;
+    flush_console(isolate);
+  }
+private:
+  void wait(){
+    double timer_ms = next_timer(isolate);
+    if(timer_ms >= 0 && timer_ms < 100){
+      std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(timer_ms));
+      return;
+    }
+    if(!timer)
+      timer.reset(new wakeup_timer(isolate, 100));
+    v8::platform::PumpMessageLoop(platformptr, isolate, v8::platform::MessageLoopBehavior::kWaitForWork);
+  }
+};
+
 static void pump_promises(){
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
   v8::platform::PumpMessageLoop(platformptr, isolate, v8::platform::MessageLoopBehavior::kDoNotWait);
   isolate->PerformMicrotaskCheckpoint();
+  run_timers(isolate);
+  flush_console(isolate);
   Rcpp::checkUserInterrupt();
 }
 
@@ -259,25 +1103,48 @@ static void ConsolePump(const v8::FunctionCallbackInfo<v8::Value>& args) {
 }
 
 
-/* console.log */
-static void ConsoleLog(const v8::FunctionCallbackInfo<v8::Value>& args) {
+/* console.log(), console.info(), console.debug() and console.warn() */
+static void console_write(const v8::FunctionCallbackInfo<v8::Value>& args, int level) {
+  v8::Isolate *isolate = args.GetIsolate();
+  context_state *cs = get_context_state(isolate->GetCurrentContext(), true);
+  if(cs && level < cs->console_level)
+    return;
+  std::string text;
   for (int i=0; i < args.Length(); i++) {
-    v8::HandleScope handle_scope(args.GetIsolate());
-    v8::String::Utf8Value str(args.GetIsolate(), args[i]);
-    Rprintf("%s", ToCString(str));
+    v8::HandleScope handle_scope(isolate);
+    v8::String::Utf8Value str(isolate, args[i]);
+    text += ToCString(str);
   }
-  Rprintf("\n");
-  //args.GetReturnValue().Set(v8::Undefined(args.GetIsolate()));
+  if(cs){
+    cs->console.push_back(std::make_pair(level, text));
+    cs->console_size += text.length();
+    if(cs->console_size > console_buffer_size)
+      flush_console(cs);
+  } else if(level == console_warn){
+    Rf_warningcall_immediate(R_NilValue, "%s", text.c_str());
+  } else {
+    Rprintf("%s\n", text.c_str());
+  }
+}
+
+/* console.log */
+static void ConsoleLog(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  console_write(args, console_info);
+}
+
+/* console.info */
+static void ConsoleInfo(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  console_write(args, console_info);
+}
+
+/* console.debug */
+static void ConsoleDebug(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  console_write(args, console_debug);
 }
 
 /* console.warn */
 static void ConsoleWarn(const v8::FunctionCallbackInfo<v8::Value>& args) {
-  for (int i=0; i < args.Length(); i++) {
-    v8::HandleScope handle_scope(args.GetIsolate());
-    v8::String::Utf8Value str(args.GetIsolate(), args[i]);
-    Rf_warningcall_immediate(R_NilValue, "%s", ToCString(str));
-  }
-  //args.GetReturnValue().Set(v8::Undefined(args.GetIsolate()));
+  console_write(args, console_warn);
 }
 
 /* console.error */
@@ -288,33 +1155,30 @@ static void ConsoleError(const v8::FunctionCallbackInfo<v8::Value>& args) {
   //args.GetReturnValue().Set(v8::Undefined(args.GetIsolate()));
 }
 
+static Rcpp::RObject callback_arg_to_r(v8::Local<v8::Context> context, v8::Local<v8::Value> value, bool json);
+static v8::Local<v8::Value> callback_result_to_js(v8::Local<v8::Context> context, SEXP x);
+
 void r_callback(std::string cb, const v8::FunctionCallbackInfo<v8::Value>& args) {
+  flush_console(args.GetIsolate());
   try {
+    v8::Local<v8::Context> context = args.GetIsolate()->GetCurrentContext();
     Rcpp::Function r_call = Rcpp::Environment::namespace_env("V8")[cb];
     v8::String::Utf8Value arg0(args.GetIsolate(), args[0]);
     Rcpp::String fun(*arg0);
-    Rcpp::CharacterVector out;
+    Rcpp::RObject out;
     if(args.Length() == 1 || args[1]->IsUndefined()){
       out = r_call(fun);
     } else if(args.Length() == 2 || args[2]->IsUndefined()) {
-      v8::Local<v8::Object> obj1 = args[1]->ToObject(args.GetIsolate()->GetCurrentContext()).ToLocalChecked();
-      v8::String::Utf8Value arg1(args.GetIsolate(), v8::JSON::Stringify(args.GetIsolate()->GetCurrentContext(), obj1).ToLocalChecked());
-      Rcpp::String json(ToCString(arg1));
-      out = r_call(fun, json);
+      out = r_call(fun, callback_arg_to_r(context, args[1], false));
     } else {
-      v8::Local<v8::Object> obj1 = args[1]->ToObject(args.GetIsolate()->GetCurrentContext()).ToLocalChecked();
-      v8::Local<v8::Object> obj2 = args[2]->ToObject(args.GetIsolate()->GetCurrentContext()).ToLocalChecked();
-      v8::String::Utf8Value arg1(args.GetIsolate(), v8::JSON::Stringify(args.GetIsolate()->GetCurrentContext(), obj1).ToLocalChecked());
-      v8::String::Utf8Value arg2(args.GetIsolate(), v8::JSON::Stringify(args.GetIsolate()->GetCurrentContext(), obj2).ToLocalChecked());
-      Rcpp::String val(ToCString(arg1));
-      Rcpp::String json(ToCString(arg2));
-      out = r_call(fun, val, json);
-    }
-    v8::Local<v8::String> outstr(ToJSString(std::string(out.at(0)).c_str()));
-    if(out.inherits("cb_error")){
-      args.GetIsolate()->ThrowException(outstr);
+      // The value for console.r.assign() with fromJSON() options is passed as JSON
+      Rcpp::RObject val = callback_arg_to_r(context, args[1], cb == "r_assign");
+      out = r_call(fun, val, callback_arg_to_r(context, args[2], false));
+    }
+    if(Rf_inherits(out, "cb_error")){
+      args.GetIsolate()->ThrowException(ToJSString(CHAR(STRING_ELT(out, 0))));
     } else {
-      args.GetReturnValue().Set( v8::JSON::Parse(args.GetIsolate()->GetCurrentContext(), outstr).ToLocalChecked());
+      args.GetReturnValue().Set(callback_result_to_js(context, out));
     }
   } catch( const std::exception& e ) {
     args.GetIsolate()->ThrowException(ToJSString(e.what()));
@@ -346,136 +1210,2198 @@ std::string version(){
   return v8::V8::GetVersion();
 }
 
-static Rcpp::RObject convert_object(v8::Local<v8::Value> value){
-  if(value.IsEmpty() || value->IsUndefined()){
-    return R_NilValue;
-  } else if(value->IsNull()){
-    return Rcpp::CharacterVector::create(Rcpp::String("null"));
-  } else if(value->IsArrayBuffer() || value->IsArrayBufferView()){
-    v8::Local<v8::ArrayBuffer> buffer = value->IsArrayBufferView() ?
-    value.As<v8::ArrayBufferView>()->Buffer() : value.As<v8::ArrayBuffer>();
-    Rcpp::RawVector data(buffer->ByteLength());
-#if V8_VERSION_TOTAL >= 1005 || NODEJS_LTS_API == 18
-    memcpy(data.begin(), buffer->Data(), data.size());
-#elif V8_VERSION_TOTAL < 901 || NODEJS_LTS_API == 16
-    memcpy(data.begin(), buffer->GetContents().Data(), data.size());
-#else
-    /* Try to avoid this API: github.com/jeroen/V8/issues/152 */
-    memcpy(data.begin(), buffer->GetBackingStore()->Data(), data.size());
+static v8::Isolate * context_isolate(SEXP ctx){
+  if(Rf_isNull(ctx))
+    return main_isolate;
+  ctxptr ptr(ctx);
+  if(!ptr)
+    throw std::runtime_error("v8::Context has been disposed.");
+  return ptr.checked_get()->isolate;
+}
+
+// [[Rcpp::export]]
+bool isolate_track_gc(SEXP ctx, bool enable){
+  v8::Isolate *isolate = context_isolate(ctx);
+  isolate_state *state = (isolate_state *) isolate->GetData(0);
+  if(enable && !state->gc.enabled){
+    state->gc = gc_state();
+    isolate->AddGCPrologueCallback(gc_prologue_cb);
+    isolate->AddGCEpilogueCallback(gc_epilogue_cb);
+  } else if(!enable && state->gc.enabled){
+    isolate->RemoveGCPrologueCallback(gc_prologue_cb);
+    isolate->RemoveGCEpilogueCallback(gc_epilogue_cb);
+  }
+  state->gc.enabled = enable;
+  return enable;
+}
+
+// [[Rcpp::export]]
+Rcpp::List isolate_stats(SEXP ctx){
+  v8::Isolate *isolate = context_isolate(ctx);
+  v8::HeapStatistics heap;
+  isolate->GetHeapStatistics(&heap);
+#if V8_VERSION_TOTAL >= 800
+  double external_memory = heap.external_memory();
+  double global_handles = heap.total_global_handles_size();
+#else
+  double external_memory = NA_REAL;
+  double global_handles = NA_REAL;
+#endif
+  Rcpp::List heapstats = Rcpp::List::create(
+    Rcpp::Named("total_heap_size") = (double) heap.total_heap_size(),
+    Rcpp::Named("total_heap_size_executable") = (double) heap.total_heap_size_executable(),
+    Rcpp::Named("total_physical_size") = (double) heap.total_physical_size(),
+    Rcpp::Named("total_available_size") = (double) heap.total_available_size(),
+    Rcpp::Named("used_heap_size") = (double) heap.used_heap_size(),
+    Rcpp::Named("heap_size_limit") = (double) heap.heap_size_limit(),
+    Rcpp::Named("malloced_memory") = (double) heap.malloced_memory(),
+    Rcpp::Named("peak_malloced_memory") = (double) heap.peak_malloced_memory(),
+    Rcpp::Named("external_memory") = external_memory,
+    Rcpp::Named("total_global_handles_size") = global_handles,
+    Rcpp::Named("native_contexts") = (double) heap.number_of_native_contexts(),
+    Rcpp::Named("detached_contexts") = (double) heap.number_of_detached_contexts()
+  );
+
+  size_t nspaces = isolate->NumberOfHeapSpaces();
+  Rcpp::CharacterVector space_name(nspaces);
+  Rcpp::NumericVector space_size(nspaces), space_used_size(nspaces), space_available_size(nspaces), physical_space_size(nspaces);
+  for(size_t i = 0; i < nspaces; i++){
+    v8::HeapSpaceStatistics space;
+    isolate->GetHeapSpaceStatistics(&space, i);
+    SET_STRING_ELT(space_name, i, Rf_mkChar(space.space_name()));
+    space_size[i] = space.space_size();
+    space_used_size[i] = space.space_used_size();
+    space_available_size[i] = space.space_available_size();
+    physical_space_size[i] = space.physical_space_size();
+  }
+  Rcpp::List spaces = Rcpp::List::create(
+    Rcpp::Named("space_name") = space_name,
+    Rcpp::Named("space_size") = space_size,
+    Rcpp::Named("space_used_size") = space_used_size,
+    Rcpp::Named("space_available_size") = space_available_size,
+    Rcpp::Named("physical_space_size") = physical_space_size
+  );
+
+  isolate_state *state = (isolate_state *) isolate->GetData(0);
+  Rcpp::NumericVector count(state->gc.count, state->gc.count + gc_types);
+  Rcpp::NumericVector time(state->gc.time, state->gc.time + gc_types);
+  Rcpp::NumericVector histogram(state->gc.histogram, state->gc.histogram + gc_bins);
+  Rcpp::List gc = Rcpp::List::create(
+    Rcpp::Named("enabled") = state->gc.enabled,
+    Rcpp::Named("count") = count,
+    Rcpp::Named("time") = time,
+    Rcpp::Named("max") = state->gc.max,
+    Rcpp::Named("histogram") = histogram
+  );
+  return Rcpp::List::create(Rcpp::Named("heap") = heapstats, Rcpp::Named("spaces") = spaces, Rcpp::Named("gc") = gc);
+}
+
+static const char * profile_title = "V8-R-profile";
+
+// [[Rcpp::export]]
+bool profiler_start(SEXP ctx, double interval = 1000){
+#ifdef HAS_CPU_PROFILER
+  v8::Isolate *isolate = context_isolate(ctx);
+  isolate_state *state = (isolate_state *) isolate->GetData(0);
+  if(state->profiler)
+    throw std::runtime_error("CPU profiler is already running for this isolate");
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  state->profiler = v8::CpuProfiler::New(isolate);
+  state->profiler->SetSamplingInterval(std::max(1, (int) interval));
+  state->profiler->StartProfiling(ToJSString(profile_title), true);
+  return true;
+#else
+  throw std::runtime_error("CPU profiling requires V8 7.0 or newer");
+#endif
+}
+
+/* Returns the call tree (in pre-order, such that parents come before children)
+ * and the samples. Aggregation into a flat profile happens in R. */
+// [[Rcpp::export]]
+Rcpp::List profiler_stop(SEXP ctx){
+#ifdef HAS_CPU_PROFILER
+  v8::Isolate *isolate = context_isolate(ctx);
+  isolate_state *state = (isolate_state *) isolate->GetData(0);
+  if(!state->profiler)
+    throw std::runtime_error("CPU profiler is not running for this isolate");
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  v8::CpuProfile *profile = state->profiler->StopProfiling(ToJSString(profile_title));
+  state->profiler->Dispose();
+  state->profiler = NULL;
+  if(!profile)
+    throw std::runtime_error("Failed to collect CPU profile");
+
+  std::vector<const v8::CpuProfileNode *> nodes;
+  std::vector<int> parents;
+  std::vector<std::pair<const v8::CpuProfileNode *, int>> stack;
+  stack.push_back(std::make_pair(profile->GetTopDownRoot(), 0));
+  while(stack.size()){
+    const v8::CpuProfileNode *node = stack.back().first;
+    parents.push_back(stack.back().second);
+    stack.pop_back();
+    nodes.push_back(node);
+    for(int i = node->GetChildrenCount() - 1; i >= 0; i--)
+      stack.push_back(std::make_pair(node->GetChild(i), (int) node->GetNodeId()));
+  }
+  size_t n = nodes.size();
+  Rcpp::IntegerVector id(n), parent(n), line(n), column(n), script(n), hits(n);
+  Rcpp::CharacterVector name(n), url(n);
+  for(size_t i = 0; i < n; i++){
+    id[i] = nodes[i]->GetNodeId();
+    parent[i] = parents[i] ? parents[i] : NA_INTEGER;
+    SET_STRING_ELT(name, i, Rf_mkCharCE(nodes[i]->GetFunctionNameStr(), CE_UTF8));
+    SET_STRING_ELT(url, i, Rf_mkCharCE(nodes[i]->GetScriptResourceNameStr(), CE_UTF8));
+    line[i] = nodes[i]->GetLineNumber();
+    column[i] = nodes[i]->GetColumnNumber();
+    script[i] = nodes[i]->GetScriptId();
+    hits[i] = nodes[i]->GetHitCount();
+  }
+  int nsamples = profile->GetSamplesCount();
+  Rcpp::IntegerVector samples(nsamples);
+  Rcpp::NumericVector timestamps(nsamples);
+  for(int i = 0; i < nsamples; i++){
+    samples[i] = profile->GetSample(i)->GetNodeId();
+    timestamps[i] = (double) profile->GetSampleTimestamp(i);
+  }
+  double start = (double) profile->GetStartTime();
+  double end = (double) profile->GetEndTime();
+  profile->Delete();
+  return Rcpp::List::create(
+    Rcpp::Named("nodes") = Rcpp::List::create(
+      Rcpp::Named("id") = id,
+      Rcpp::Named("parent") = parent,
+      Rcpp::Named("function") = name,
+      Rcpp::Named("url") = url,
+      Rcpp::Named("line") = line,
+      Rcpp::Named("column") = column,
+      Rcpp::Named("script_id") = script,
+      Rcpp::Named("hits") = hits
+    ),
+    Rcpp::Named("samples") = samples,
+    Rcpp::Named("timestamps") = timestamps,
+    Rcpp::Named("start") = start,
+    Rcpp::Named("end") = end
+  );
+#else
+  throw std::runtime_error("CPU profiling requires V8 7.0 or newer");
+#endif
+}
+
+/* Streams the serialized heap snapshot to a file in chunks */
+class file_output_stream : public v8::OutputStream {
+  std::ofstream &output;
+public:
+  file_output_stream(std::ofstream &output) : output(output) {}
+  int GetChunkSize(){
+    return 65536;
+  }
+  void EndOfStream(){
+    output.flush();
+  }
+  WriteResult WriteAsciiChunk(char *data, int size){
+    output.write(data, size);
+    return output.good() ? kContinue : kAbort;
+  }
+};
+
+// [[Rcpp::export]]
+std::string isolate_heap_snapshot(std::string path, SEXP ctx){
+  v8::Isolate *isolate = context_isolate(ctx);
+  std::ofstream output(path.c_str(), std::ios::out | std::ios::binary);
+  if(!output.is_open())
+    throw std::runtime_error("Failed to open file: " + path);
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  v8::HeapProfiler *profiler = isolate->GetHeapProfiler();
+  const v8::HeapSnapshot *snapshot = profiler->TakeHeapSnapshot();
+  if(!snapshot)
+    throw std::runtime_error("Failed to take heap snapshot");
+  file_output_stream stream(output);
+  snapshot->Serialize(&stream, v8::HeapSnapshot::kJSON);
+  const_cast<v8::HeapSnapshot *>(snapshot)->Delete();
+  output.close();
+  if(output.fail())
+    throw std::runtime_error("Failed to write heap snapshot to: " + path);
+  return path;
+}
+
+// [[Rcpp::export]]
+bool isolate_sampling_start(SEXP ctx, double interval = 524288, int stack_depth = 16){
+  v8::Isolate *isolate = context_isolate(ctx);
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  if(!isolate->GetHeapProfiler()->StartSamplingHeapProfiler((uint64_t) std::max(1.0, interval), stack_depth))
+    throw std::runtime_error("Sampling heap profiler is already running for this isolate");
+  return true;
+}
+
+/* Returns the allocation tree (in pre-order) with the size of live objects
+ * that were sampled at each node, and stops the profiler. */
+// [[Rcpp::export]]
+Rcpp::List isolate_sampling_stop(SEXP ctx){
+  v8::Isolate *isolate = context_isolate(ctx);
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  v8::HeapProfiler *profiler = isolate->GetHeapProfiler();
+  std::unique_ptr<v8::AllocationProfile> profile(profiler->GetAllocationProfile());
+  if(!profile)
+    throw std::runtime_error("Sampling heap profiler is not running for this isolate");
+
+  std::vector<v8::AllocationProfile::Node *> nodes;
+  std::vector<int> parents;
+  std::vector<std::pair<v8::AllocationProfile::Node *, int>> stack;
+  stack.push_back(std::make_pair(profile->GetRootNode(), 0));
+  while(stack.size()){
+    v8::AllocationProfile::Node *node = stack.back().first;
+    parents.push_back(stack.back().second);
+    stack.pop_back();
+    nodes.push_back(node);
+    int index = (int) nodes.size();
+    for(size_t i = node->children.size(); i > 0; i--)
+      stack.push_back(std::make_pair(node->children[i - 1], index));
+  }
+  size_t n = nodes.size();
+  Rcpp::IntegerVector parent(n), line(n), column(n), script(n);
+  Rcpp::NumericVector size(n), count(n);
+  Rcpp::CharacterVector name(n), url(n);
+  for(size_t i = 0; i < n; i++){
+    v8::AllocationProfile::Node *node = nodes[i];
+    v8::String::Utf8Value fun_name(isolate, node->name);
+    v8::String::Utf8Value script_name(isolate, node->script_name);
+    parent[i] = parents[i] ? parents[i] : NA_INTEGER;
+    SET_STRING_ELT(name, i, Rf_mkCharCE(*fun_name ? *fun_name : "", CE_UTF8));
+    SET_STRING_ELT(url, i, Rf_mkCharCE(*script_name ? *script_name : "", CE_UTF8));
+    line[i] = node->line_number;
+    column[i] = node->column_number;
+    script[i] = node->script_id;
+    double bytes = 0, objects = 0;
+    for(size_t j = 0; j < node->allocations.size(); j++){
+      bytes += (double) node->allocations[j].size * node->allocations[j].count;
+      objects += node->allocations[j].count;
+    }
+    size[i] = bytes;
+    count[i] = objects;
+  }
+  profile.reset();
+  profiler->StopSamplingHeapProfiler();
+  return Rcpp::List::create(
+    Rcpp::Named("parent") = parent,
+    Rcpp::Named("function") = name,
+    Rcpp::Named("url") = url,
+    Rcpp::Named("line") = line,
+    Rcpp::Named("column") = column,
+    Rcpp::Named("script_id") = script,
+    Rcpp::Named("size") = size,
+    Rcpp::Named("count") = count
+  );
+}
+
+static unsigned char * buffer_contents(v8::Local<v8::ArrayBuffer> buffer){
+#if V8_VERSION_TOTAL >= 1005 || NODEJS_LTS_API == 18
+  return (unsigned char *) buffer->Data();
+#elif V8_VERSION_TOTAL < 901 || NODEJS_LTS_API == 16
+  return (unsigned char *) buffer->GetContents().Data();
+#else
+  /* Try to avoid this API: github.com/jeroen/V8/issues/152 */
+  return (unsigned char *) buffer->GetBackingStore()->Data();
+#endif
+}
+
+/* Raw data of an ArrayBuffer, or the part of the buffer covered by a view */
+static unsigned char * buffer_data(v8::Local<v8::Value> value, size_t *length){
+  if(value->IsArrayBufferView()){
+    v8::Local<v8::ArrayBufferView> view = value.As<v8::ArrayBufferView>();
+    *length = view->ByteLength();
+    return buffer_contents(view->Buffer()) + view->ByteOffset();
+  }
+  v8::Local<v8::ArrayBuffer> buffer = value.As<v8::ArrayBuffer>();
+  *length = buffer->ByteLength();
+  return buffer_contents(buffer);
+}
+
+static Rcpp::RObject js_buffer_to_raw(v8::Local<v8::Value> value){
+  size_t length = 0;
+  unsigned char *src = buffer_data(value, &length);
+  Rcpp::RawVector data(length);
+  if(length)
+    memcpy(data.begin(), src, length);
+  return data;
+}
+
+/* Typed arrays with numbers become integer or double vectors. Uint8Array and
+ * other buffers are returned as raw vectors by js_buffer_to_raw() */
+static bool is_numeric_array(v8::Local<v8::Value> x){
+  return x->IsTypedArray() && !x->IsUint8Array() && !x->IsUint8ClampedArray();
+}
+
+template <typename T>
+static void copy_numbers(double *out, unsigned char *data, size_t n){
+  T *src = (T *) data;
+  for(size_t i = 0; i < n; i++)
+    out[i] = (double) src[i];
+}
+
+template <typename T>
+static void copy_integers(int *out, unsigned char *data, size_t n){
+  T *src = (T *) data;
+  for(size_t i = 0; i < n; i++)
+    out[i] = (int) src[i];
+}
+
+static Rcpp::RObject js_typed_array_to_r(v8::Local<v8::Value> value){
+  size_t bytes = 0;
+  unsigned char *data = buffer_data(value, &bytes);
+  size_t n = value.As<v8::TypedArray>()->Length();
+  if(value->IsInt32Array()){
+    Rcpp::IntegerVector out(n);
+    if(n)
+      memcpy(INTEGER(out), data, n * sizeof(int32_t));
+    return out;
+  } else if(value->IsInt16Array() || value->IsInt8Array() || value->IsUint16Array()){
+    Rcpp::IntegerVector out(n);
+    if(value->IsInt16Array())
+      copy_integers<int16_t>(INTEGER(out), data, n);
+    else if(value->IsInt8Array())
+      copy_integers<int8_t>(INTEGER(out), data, n);
+    else
+      copy_integers<uint16_t>(INTEGER(out), data, n);
+    return out;
+  }
+  Rcpp::NumericVector out(n);
+  if(value->IsFloat64Array()){
+    if(n)
+      memcpy(REAL(out), data, n * sizeof(double));
+  } else if(value->IsFloat32Array()){
+    copy_numbers<float>(REAL(out), data, n);
+  } else if(value->IsUint32Array()){
+    copy_numbers<uint32_t>(REAL(out), data, n);
+  } else if(value->IsBigInt64Array()){
+    copy_numbers<int64_t>(REAL(out), data, n);
+  } else if(value->IsBigUint64Array()){
+    copy_numbers<uint64_t>(REAL(out), data, n);
+  } else {
+    return js_buffer_to_raw(value);
+  }
+  return out;
+}
+
+#ifdef HAS_ZERO_COPY
+/* ALTREP raw vector that views the backing store of an ArrayBuffer and keeps
+ * it alive, such that the memory is shared between R and JS without a copy.
+ * The view becomes invalid when the ArrayBuffer is detached, e.g. because a
+ * WebAssembly.Memory has grown, after which V8 no longer uses this store. */
+struct buffer_view {
+  std::shared_ptr<v8::BackingStore> store;
+  size_t offset;
+  size_t length;
+  v8::Isolate *isolate;
+  v8::Global<v8::ArrayBuffer> buffer;
+  size_t byte_length;  // of the buffer when the view was created
+};
+
+static R_altrep_class_t buffer_view_class;
+
+static buffer_view * get_buffer_view(SEXP x){
+  buffer_view *view = (buffer_view*) R_ExternalPtrAddr(R_altrep_data1(x));
+  if(!view)
+    Rf_error("ArrayBuffer view has been released");
+  return view;
+}
+
+/* Detached buffers have a length of zero */
+static bool buffer_view_valid(buffer_view *view){
+  v8::Isolate::Scope isolate_scope(view->isolate);
+  v8::HandleScope handle_scope(view->isolate);
+  return view->buffer.Get(view->isolate)->ByteLength() == view->byte_length;
+}
+
+static void buffer_view_finalizer(SEXP ptr){
+  delete (buffer_view*) R_ExternalPtrAddr(ptr);
+  R_ClearExternalPtr(ptr);
+}
+
+static R_xlen_t buffer_view_length(SEXP x){
+  return get_buffer_view(x)->length;
+}
+
+static void * buffer_view_dataptr(SEXP x, Rboolean writeable){
+  static Rbyte empty = 0;
+  buffer_view *view = get_buffer_view(x);
+  if(!buffer_view_valid(view))
+    Rf_error("ArrayBuffer view is no longer valid because the buffer was detached or has grown");
+  unsigned char *data = (unsigned char*) view->store->Data();
+  return data ? data + view->offset : &empty;
+}
+
+/* R falls back to Elt(), which raises the error, if the view is no longer valid */
+static const void * buffer_view_dataptr_or_null(SEXP x){
+  if(!buffer_view_valid(get_buffer_view(x)))
+    return NULL;
+  return buffer_view_dataptr(x, FALSE);
+}
+
+static Rbyte buffer_view_elt(SEXP x, R_xlen_t i){
+  return ((Rbyte*) buffer_view_dataptr(x, FALSE))[i];
+}
+
+static Rboolean buffer_view_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)){
+  buffer_view *view = get_buffer_view(x);
+  Rprintf("V8 ArrayBuffer view (len=%ld%s)\n", (long) view->length, buffer_view_valid(view) ? "" : ", detached");
+  return TRUE;
+}
+
+static void register_buffer_view(DllInfo *dll){
+  buffer_view_class = R_make_altraw_class("v8_buffer_view", "V8", dll);
+  R_set_altrep_Length_method(buffer_view_class, buffer_view_length);
+  R_set_altrep_Inspect_method(buffer_view_class, buffer_view_inspect);
+  R_set_altvec_Dataptr_method(buffer_view_class, buffer_view_dataptr);
+  R_set_altvec_Dataptr_or_null_method(buffer_view_class, buffer_view_dataptr_or_null);
+  R_set_altraw_Elt_method(buffer_view_class, buffer_view_elt);
+}
+
+/* The view protects the context, such that the isolate outlives the handle to the buffer */
+static Rcpp::RObject new_buffer_view(v8::Local<v8::ArrayBuffer> buffer, size_t offset, size_t length, SEXP ctx){
+  buffer_view *view = new buffer_view();
+  view->store = buffer->GetBackingStore();
+  view->offset = offset;
+  view->length = length;
+  view->isolate = v8::Isolate::GetCurrent();
+  view->buffer.Reset(view->isolate, buffer);
+  view->byte_length = buffer->ByteLength();
+  Rcpp::Shield<SEXP> ptr(R_MakeExternalPtr(view, R_NilValue, ctx));
+  R_RegisterCFinalizerEx(ptr, buffer_view_finalizer, TRUE);
+  return R_new_altrep(buffer_view_class, ptr, R_NilValue);
+}
+
+static Rcpp::RObject js_buffer_view(v8::Local<v8::Value> value, SEXP ctx){
+  if(value->IsArrayBufferView()){
+    v8::Local<v8::ArrayBufferView> x = value.As<v8::ArrayBufferView>();
+    return new_buffer_view(x->Buffer(), x->ByteOffset(), x->ByteLength(), ctx);
+  }
+  v8::Local<v8::ArrayBuffer> buffer = value.As<v8::ArrayBuffer>();
+  return new_buffer_view(buffer, 0, buffer->ByteLength(), ctx);
+}
+
+/* R vectors that back an ArrayBuffer are preserved until V8 releases the
+ * BackingStore. This may happen on a background thread during GC, so we
+ * only queue them here, and release them later on the main thread. */
+static std::mutex release_mutex;
+static std::vector<SEXP> release_queue;
+
+static void release_r_buffer(void *data, size_t length, void *deleter_data){
+  std::lock_guard<std::mutex> lock(release_mutex);
+  release_queue.push_back((SEXP) deleter_data);
+}
+
+static void release_r_buffers(){
+  std::lock_guard<std::mutex> lock(release_mutex);
+  for(size_t i = 0; i < release_queue.size(); i++)
+    R_ReleaseObject(release_queue[i]);
+  release_queue.clear();
+}
+#else
+static void release_r_buffers(){}
+#endif
+
+static Rcpp::RObject convert_object(v8::Local<v8::Value> value){
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+  if(value.IsEmpty() || value->IsUndefined()){
+    return R_NilValue;
+  } else if(value->IsNull()){
+    return Rcpp::CharacterVector::create(Rcpp::String("null"));
+  } else if(value->IsArrayBuffer() || value->IsArrayBufferView()){
+    return js_buffer_to_raw(value);
+  } else {
+    //convert to string without jsonify
+    //v8::String::Utf8Value utf8(isolate, value);
+    v8::Local<v8::Object> obj1 = value->ToObject(isolate->GetCurrentContext()).ToLocalChecked();
+    v8::String::Utf8Value utf8(isolate, v8::JSON::Stringify(isolate->GetCurrentContext(), obj1).ToLocalChecked());
+    return Rcpp::CharacterVector::create(Rcpp::String(*utf8));
+  }
+}
+
+/* Native conversion of JS values into R objects, following the same simplification
+ * rules as jsonlite::fromJSON(), i.e. what you would get with JSON.stringify + fromJSON */
+enum r_scalar_type { JS_NULL, JS_LOGICAL, JS_INTEGER, JS_DOUBLE, JS_STRING, JS_OTHER };
+
+static const int max_convert_depth = 1000;
+
+/* Range check first: casting a double outside the int range is undefined */
+static bool is_int32(double x){
+  return x >= -2147483647 && x <= 2147483647 && x == (int) x;
+}
+
+static bool is_record(v8::Local<v8::Value> x){
+  return x->IsObject() && !x->IsArray() && !x->IsFunction() && !x->IsArrayBuffer() && !x->IsArrayBufferView();
+}
+
+/* Values that JSON.stringify() turns into null (in arrays) or skips (in objects) */
+static bool is_json_void(v8::Local<v8::Value> x){
+  return x->IsUndefined() || x->IsFunction() || x->IsSymbol();
+}
+
+static double js_number(v8::Local<v8::Value> x){
+  if(x->IsBigInt())
+    return (double) x.As<v8::BigInt>()->Int64Value();
+  return x.As<v8::Number>()->Value();
+}
+
+/* Property lookups may run getters that throw */
+static v8::Local<v8::Value> js_get(v8::Local<v8::Context> context, v8::Local<v8::Object> obj, v8::Local<v8::Value> key){
+  v8::Local<v8::Value> out;
+  if(!obj->Get(context, key).ToLocal(&out))
+    throw std::runtime_error("Failed to read property of object");
+  return out;
+}
+
+static int scalar_type(v8::Local<v8::Value> x){
+  if(x->IsNull() || is_json_void(x))
+    return JS_NULL;
+  if(x->IsBoolean())
+    return JS_LOGICAL;
+  if(x->IsNumber()){
+    double val = x.As<v8::Number>()->Value();
+    if(!std::isfinite(val))
+      return JS_NULL;
+    return is_int32(val) ? JS_INTEGER : JS_DOUBLE;
+  }
+  if(x->IsString())
+    return JS_STRING;
+  if(x->IsBigInt())
+    return JS_DOUBLE;
+  return JS_OTHER;
+}
+
+/* Like JSON.stringify(), use the toJSON() method if an object has one (e.g. Date) */
+static v8::Local<v8::Value> apply_to_json(v8::Local<v8::Context> context, v8::Local<v8::Value> x){
+  if(!is_record(x))
+    return x;
+  v8::Local<v8::Value> fun;
+  v8::Local<v8::Object> obj = x.As<v8::Object>();
+  if(obj->Get(context, ToJSString("toJSON")).ToLocal(&fun) && fun->IsFunction()){
+    v8::Local<v8::Value> out;
+    if(fun.As<v8::Function>()->Call(context, obj, 0, NULL).ToLocal(&out))
+      return out;
+    throw std::runtime_error("Failed to call toJSON() method");
+  }
+  return x;
+}
+
+static SEXP js_to_char(v8::Isolate *isolate, v8::Local<v8::Value> x, int type){
+  switch(type){
+  case JS_NULL:
+    return NA_STRING;
+  case JS_LOGICAL:
+    return Rf_mkChar(x->IsTrue() ? "TRUE" : "FALSE");
+  default:
+    v8::String::Utf8Value str(isolate, x);
+    return Rf_mkCharLenCE(*str, str.length(), CE_UTF8);
+  }
+}
+
+/* Creates an atomic vector from scalars, coercing to the highest type (like unlist) */
+static SEXP js_to_atomic(v8::Isolate *isolate, std::vector<v8::Local<v8::Value>> &values, std::vector<int> &types, int maxtype){
+  size_t n = values.size();
+  switch(maxtype){
+  case JS_NULL:
+  case JS_LOGICAL: {
+    Rcpp::LogicalVector out(n);
+    for(size_t i = 0; i < n; i++)
+      out[i] = types[i] == JS_NULL ? NA_LOGICAL : values[i]->IsTrue();
+    return out;
+  }
+  case JS_INTEGER: {
+    Rcpp::IntegerVector out(n);
+    for(size_t i = 0; i < n; i++)
+      out[i] = types[i] == JS_NULL ? NA_INTEGER : types[i] == JS_LOGICAL ? values[i]->IsTrue() : (int) js_number(values[i]);
+    return out;
+  }
+  case JS_DOUBLE: {
+    Rcpp::NumericVector out(n);
+    for(size_t i = 0; i < n; i++)
+      out[i] = types[i] == JS_NULL ? NA_REAL : types[i] == JS_LOGICAL ? values[i]->IsTrue() : js_number(values[i]);
+    return out;
+  }
+  default: {
+    Rcpp::CharacterVector out(n);
+    for(size_t i = 0; i < n; i++)
+      SET_STRING_ELT(out, i, js_to_char(isolate, values[i], types[i]));
+    return out;
+  }
+  }
+}
+
+static Rcpp::RObject js_to_r(v8::Local<v8::Context> context, v8::Local<v8::Value> value, bool simplify, int depth);
+static Rcpp::RObject js_values_to_r(v8::Local<v8::Context> context, std::vector<v8::Local<v8::Value>> &values, bool simplify, int depth);
+
+/* Array of records becomes a data frame, with columns simplified recursively */
+/* Like jsonlite, the _row column only becomes row names if these are unique */
+static bool valid_row_names(SEXP col){
+  if(TYPEOF(col) != STRSXP)
+    return false;
+  for(R_xlen_t i = 0; i < Rf_xlength(col); i++){
+    if(STRING_ELT(col, i) == NA_STRING)
+      return false;
+  }
+  return Rf_any_duplicated(col, FALSE) == 0;
+}
+
+static Rcpp::RObject js_records_to_df(v8::Local<v8::Context> context, std::vector<v8::Local<v8::Value>> &rows, int depth){
+  v8::Isolate *isolate = context->GetIsolate();
+  std::vector<std::string> names;
+  std::vector<v8::Local<v8::Value>> colkeys;
+  std::map<std::string, size_t> index;
+  std::vector<std::vector<v8::Local<v8::Value>>> columns;
+  size_t nrow = rows.size();
+  for(size_t i = 0; i < nrow; i++){
+    if(!is_record(rows[i]))
+      continue;
+    v8::Local<v8::Object> row = rows[i].As<v8::Object>();
+    v8::Local<v8::Array> keys = row->GetOwnPropertyNames(context).ToLocalChecked();
+    for(uint32_t j = 0; j < keys->Length(); j++){
+      v8::Local<v8::Value> key = keys->Get(context, j).ToLocalChecked();
+      v8::Local<v8::Value> val = apply_to_json(context, js_get(context, row, key));
+      if(is_json_void(val))
+        continue;
+      // Fast path: records usually have the same keys in the same order
+      size_t col = j;
+      if(j >= colkeys.size() || !key->StrictEquals(colkeys[j])){
+        v8::String::Utf8Value keystr(isolate, key);
+        std::string name(ToCString(keystr));
+        std::map<std::string, size_t>::iterator it = index.find(name);
+        if(it == index.end()){
+          it = index.insert(std::make_pair(name, names.size())).first;
+          names.push_back(name);
+          colkeys.push_back(key);
+          columns.push_back(std::vector<v8::Local<v8::Value>>(nrow, v8::Null(isolate)));
+        }
+        col = it->second;
+      }
+      columns[col][i] = val;
+    }
+  }
+  Rcpp::List df(names.size());
+  Rcpp::CharacterVector colnames(names.size());
+  Rcpp::RObject rownames = Rcpp::IntegerVector::create(NA_INTEGER, -((int) nrow));
+  size_t k = 0;
+  for(size_t i = 0; i < names.size(); i++){
+    Rcpp::RObject col = js_values_to_r(context, columns[i], true, depth + 1);
+    if(names[i] == "_row" && valid_row_names(col)){
+      rownames = col;
+      continue;
+    }
+    df[k] = col;
+    colnames[k] = Rcpp::String(names[i], CE_UTF8);
+    k++;
+  }
+  if(k < names.size()){
+    df = Rcpp::List(df.begin(), df.begin() + k);
+    colnames = Rcpp::CharacterVector(colnames.begin(), colnames.begin() + k);
+  }
+  df.attr("names") = colnames;
+  df.attr("row.names") = rownames;
+  df.attr("class") = "data.frame";
+  return df;
+}
+
+/* Simplifies a sequence of values (a JS array or data frame column) */
+static Rcpp::RObject js_values_to_r(v8::Local<v8::Context> context, std::vector<v8::Local<v8::Value>> &values, bool simplify, int depth){
+  if(depth > max_convert_depth)
+    throw std::runtime_error("Failed to convert value: maximum depth exceeded (circular structure?)");
+  size_t n = values.size();
+  if(simplify && n > 0){
+    std::vector<int> types(n);
+    int maxtype = JS_NULL;
+    bool all_records = true;
+    bool any_record = false;
+    for(size_t i = 0; i < n; i++){
+      values[i] = apply_to_json(context, values[i]);
+      types[i] = scalar_type(values[i]);
+      maxtype = std::max(maxtype, types[i]);
+      bool record = is_record(values[i]);
+      any_record = any_record || record;
+      all_records = all_records && (record || types[i] == JS_NULL);
+    }
+    if(maxtype < JS_OTHER)
+      return js_to_atomic(context->GetIsolate(), values, types, maxtype);
+    if(all_records && any_record)
+      return js_records_to_df(context, values, depth);
+
+    // Arrays of equal length arrays of scalars become a matrix
+    bool is_matrix = true;
+    uint32_t ncol = 0;
+    int celltype = JS_NULL;
+    std::vector<v8::Local<v8::Value>> cells;
+    std::vector<int> celltypes;
+    for(size_t i = 0; i < n && is_matrix; i++){
+      if(!values[i]->IsArray()){
+        is_matrix = false;
+        break;
+      }
+      v8::Local<v8::Array> row = values[i].As<v8::Array>();
+      if(i == 0)
+        ncol = row->Length();
+      if(ncol == 0 || row->Length() != ncol){
+        is_matrix = false;
+        break;
+      }
+      for(uint32_t j = 0; j < ncol; j++){
+        v8::Local<v8::Value> cell = apply_to_json(context, js_get(context, row, v8::Integer::NewFromUnsigned(context->GetIsolate(), j)));
+        int type = scalar_type(cell);
+        if(type == JS_OTHER){
+          is_matrix = false;
+          break;
+        }
+        celltype = std::max(celltype, type);
+        cells.push_back(cell);
+        celltypes.push_back(type);
+      }
+    }
+    if(is_matrix){
+      // cells are in row-major order
+      std::vector<v8::Local<v8::Value>> colmajor(cells.size());
+      std::vector<int> coltypes(cells.size());
+      for(size_t i = 0; i < n; i++){
+        for(uint32_t j = 0; j < ncol; j++){
+          colmajor[j * n + i] = cells[i * ncol + j];
+          coltypes[j * n + i] = celltypes[i * ncol + j];
+        }
+      }
+      Rcpp::RObject out = js_to_atomic(context->GetIsolate(), colmajor, coltypes, celltype);
+      out.attr("dim") = Rcpp::IntegerVector::create(n, ncol);
+      return out;
+    }
+  }
+  Rcpp::List out(n);
+  for(size_t i = 0; i < n; i++){
+    v8::Local<v8::Value> val = is_json_void(values[i]) ? v8::Local<v8::Value>(v8::Null(context->GetIsolate())) : values[i];
+    out[i] = js_to_r(context, val, simplify, depth + 1);
+  }
+  return out;
+}
+
+static Rcpp::RObject js_to_r(v8::Local<v8::Context> context, v8::Local<v8::Value> value, bool simplify, int depth){
+  v8::Isolate *isolate = context->GetIsolate();
+  if(depth > max_convert_depth)
+    throw std::runtime_error("Failed to convert value: maximum depth exceeded (circular structure?)");
+  if(value.IsEmpty())
+    return R_NilValue;
+  if(is_numeric_array(value))
+    return js_typed_array_to_r(value);
+  if(value->IsArrayBuffer() || value->IsArrayBufferView())
+    return js_buffer_to_raw(value);
+  value = apply_to_json(context, value);
+  if(value->IsArray()){
+    v8::Local<v8::Array> array = value.As<v8::Array>();
+    std::vector<v8::Local<v8::Value>> values(array->Length());
+    for(uint32_t i = 0; i < values.size(); i++)
+      values[i] = js_get(context, array, v8::Integer::NewFromUnsigned(isolate, i));
+    return js_values_to_r(context, values, simplify, depth);
+  }
+  if(is_record(value)){
+    v8::Local<v8::Object> obj = value.As<v8::Object>();
+    v8::Local<v8::Array> keys = obj->GetOwnPropertyNames(context).ToLocalChecked();
+    Rcpp::List out(keys->Length());
+    Rcpp::CharacterVector names(keys->Length());
+    size_t k = 0;
+    for(uint32_t i = 0; i < keys->Length(); i++){
+      v8::Local<v8::Value> key = keys->Get(context, i).ToLocalChecked();
+      v8::Local<v8::Value> val = apply_to_json(context, js_get(context, obj, key));
+      if(is_json_void(val))
+        continue;
+      v8::String::Utf8Value keystr(isolate, key);
+      out[k] = js_to_r(context, val, simplify, depth + 1);
+      names[k] = Rcpp::String(ToCString(keystr), CE_UTF8);
+      k++;
+    }
+    if(k < keys->Length()){
+      out = Rcpp::List(out.begin(), out.begin() + k);
+      names = Rcpp::CharacterVector(names.begin(), names.begin() + k);
+    }
+    out.attr("names") = names;
+    return out;
+  }
+  std::vector<v8::Local<v8::Value>> values(1, value);
+  std::vector<int> types(1, scalar_type(value));
+  if(types[0] == JS_NULL || types[0] == JS_OTHER)
+    return R_NilValue;
+  return js_to_atomic(isolate, values, types, types[0]);
+}
+
+/* Native conversion of R objects into JS values, following the defaults of
+ * jsonlite::toJSON(). Returns an empty handle for types that have no native
+ * mapping, in which case the caller should fall back on JSON. */
+static v8::Local<v8::Array> new_array(v8::Local<v8::Context> context, std::vector<v8::Local<v8::Value>> &values){
+#if V8_VERSION_TOTAL >= 800
+  return v8::Array::New(context->GetIsolate(), values.data(), values.size());
+#else
+  v8::Local<v8::Array> out = v8::Array::New(context->GetIsolate(), values.size());
+  for(size_t i = 0; i < values.size(); i++)
+    out->Set(context, i, values[i]).FromMaybe(false);
+  return out;
+#endif
+}
+
+static bool r_is_plain_atomic(SEXP x){
+  switch(TYPEOF(x)){
+  case LGLSXP:
+  case REALSXP:
+  case STRSXP:
+    return Rf_isNull(Rf_getAttrib(x, R_ClassSymbol));
+  case INTSXP:
+    return Rf_isNull(Rf_getAttrib(x, R_ClassSymbol)) || Rf_isFactor(x);
+  default:
+    return false;
+  }
+}
+
+static bool r_elt_is_na(SEXP x, R_xlen_t i){
+  switch(TYPEOF(x)){
+  case LGLSXP:
+    return LOGICAL(x)[i] == NA_LOGICAL;
+  case INTSXP:
+    return INTEGER(x)[i] == NA_INTEGER;
+  case REALSXP:
+    return ISNAN(REAL(x)[i]);
+  case STRSXP:
+    return STRING_ELT(x, i) == NA_STRING;
+  default:
+    return false;
+  }
+}
+
+/* Missing numbers become strings like in toJSON(na = "string") */
+static v8::Local<v8::Value> r_elt_to_js(v8::Isolate *isolate, SEXP x, R_xlen_t i){
+  switch(TYPEOF(x)){
+  case LGLSXP:
+    if(LOGICAL(x)[i] == NA_LOGICAL)
+      return v8::Null(isolate);
+    return v8::Boolean::New(isolate, LOGICAL(x)[i]);
+  case INTSXP:
+    if(Rf_isFactor(x)){
+      if(INTEGER(x)[i] == NA_INTEGER)
+        return v8::Null(isolate);
+      SEXP levels = Rf_getAttrib(x, R_LevelsSymbol);
+      return ToJSString(Rf_translateCharUTF8(STRING_ELT(levels, INTEGER(x)[i] - 1)));
+    }
+    if(INTEGER(x)[i] == NA_INTEGER)
+      return ToJSString("NA");
+    return v8::Integer::New(isolate, INTEGER(x)[i]);
+  case REALSXP: {
+    double val = REAL(x)[i];
+    if(ISNA(val))
+      return ToJSString("NA");
+    if(ISNAN(val))
+      return ToJSString("NaN");
+    if(!std::isfinite(val))
+      return ToJSString(val > 0 ? "Inf" : "-Inf");
+    return v8::Number::New(isolate, val);
+  }
+  case STRSXP:
+    if(STRING_ELT(x, i) == NA_STRING)
+      return v8::Null(isolate);
+    return ToJSString(Rf_translateCharUTF8(STRING_ELT(x, i)));
+  default:
+    return v8::Undefined(isolate);
+  }
+}
+
+/* Data frames become an array of records, skipping missing values */
+static bool r_df_columns(SEXP x, std::vector<v8::Local<v8::String>> &keys){
+  R_xlen_t ncol = Rf_xlength(x);
+  R_xlen_t nrow = Rf_xlength(Rf_getAttrib(x, R_RowNamesSymbol));
+  SEXP names = Rf_getAttrib(x, R_NamesSymbol);
+  keys.resize(ncol);
+  for(R_xlen_t j = 0; j < ncol; j++){
+    SEXP col = VECTOR_ELT(x, j);
+    if(!r_is_plain_atomic(col) || !Rf_isNull(Rf_getAttrib(col, R_DimSymbol)) || Rf_xlength(col) != nrow)
+      return false;
+    keys[j] = ToJSString(Rf_translateCharUTF8(STRING_ELT(names, j)));
+  }
+  return true;
+}
+
+static v8::Local<v8::Object> r_df_row_to_js(v8::Local<v8::Context> context, SEXP x, R_xlen_t i, std::vector<v8::Local<v8::String>> &keys){
+  v8::Isolate *isolate = context->GetIsolate();
+  v8::Local<v8::Object> row = v8::Object::New(isolate);
+  SEXP rownames = Rf_getAttrib(x, R_RowNamesSymbol);
+  if(TYPEOF(rownames) == STRSXP)
+    row->Set(context, ToJSString("_row"), r_elt_to_js(isolate, rownames, i)).FromMaybe(false);
+  for(size_t j = 0; j < keys.size(); j++){
+    SEXP col = VECTOR_ELT(x, j);
+    if(!r_elt_is_na(col, i))
+      row->Set(context, keys[j], r_elt_to_js(isolate, col, i)).FromMaybe(false);
+  }
+  return row;
+}
+
+static v8::Local<v8::Value> r_df_to_js(v8::Local<v8::Context> context, SEXP x){
+  std::vector<v8::Local<v8::String>> keys;
+  if(!r_df_columns(x, keys))
+    return v8::Local<v8::Value>();
+  R_xlen_t nrow = Rf_xlength(Rf_getAttrib(x, R_RowNamesSymbol));
+  std::vector<v8::Local<v8::Value>> rows(nrow);
+  for(R_xlen_t i = 0; i < nrow; i++)
+    rows[i] = r_df_row_to_js(context, x, i, keys);
+  return new_array(context, rows);
+}
+
+/* ArrayBuffer with a copy of the data, or wrapping the memory of R vector x.
+ * The V8 sandbox does not allow for external buffers. */
+static v8::Local<v8::ArrayBuffer> r_array_buffer(v8::Isolate *isolate, SEXP x, void *data, size_t size, bool copy){
+#if defined(HAS_ZERO_COPY) && !defined(V8_ENABLE_SANDBOX)
+  if(!copy){
+    MARK_NOT_MUTABLE(x);
+    R_PreserveObject(x);
+    return v8::ArrayBuffer::New(isolate, v8::ArrayBuffer::NewBackingStore(data, size, release_r_buffer, x));
+  }
+#endif
+  v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(isolate, size);
+  if(size)
+    memcpy(buffer_contents(buffer), data, size);
+  return buffer;
+}
+
+/* Doubles become Float64Array, integers Int32Array and logicals Uint8Array.
+ * Logical vectors with missing values cannot be represented and become an array. */
+static v8::Local<v8::Value> r_to_typed_array(v8::Isolate *isolate, SEXP x, bool copy){
+  R_xlen_t n = Rf_xlength(x);
+  switch(TYPEOF(x)){
+  case REALSXP:
+    return v8::Float64Array::New(r_array_buffer(isolate, x, REAL(x), n * sizeof(double), copy), 0, n);
+  case INTSXP:
+    return v8::Int32Array::New(r_array_buffer(isolate, x, INTEGER(x), n * sizeof(int), copy), 0, n);
+  case LGLSXP: {
+    for(R_xlen_t i = 0; i < n; i++){
+      if(LOGICAL(x)[i] == NA_LOGICAL)
+        return v8::Local<v8::Value>();
+    }
+    v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(isolate, n);
+    unsigned char *data = buffer_contents(buffer);
+    for(R_xlen_t i = 0; i < n; i++)
+      data[i] = LOGICAL(x)[i];
+    return v8::Uint8Array::New(buffer, 0, n);
+  }
+  default:
+    return v8::Local<v8::Value>();
+  }
+}
+
+static v8::Local<v8::Value> r_to_js(v8::Local<v8::Context> context, SEXP x, bool auto_unbox, bool typed = false, bool copy = true){
+  v8::Isolate *isolate = context->GetIsolate();
+  switch(TYPEOF(x)){
+  case NILSXP:
+    return v8::Object::New(isolate);
+  case LGLSXP:
+  case INTSXP:
+  case REALSXP:
+  case STRSXP: {
+    if(!r_is_plain_atomic(x))
+      return v8::Local<v8::Value>();
+    R_xlen_t n = Rf_xlength(x);
+    SEXP dim = Rf_getAttrib(x, R_DimSymbol);
+    if(!Rf_isNull(dim)){
+      // Matrices become an array of rows
+      if(Rf_length(dim) != 2)
+        return v8::Local<v8::Value>();
+      int nrow = INTEGER(dim)[0];
+      int ncol = INTEGER(dim)[1];
+      std::vector<v8::Local<v8::Value>> rows(nrow);
+      std::vector<v8::Local<v8::Value>> cells(ncol);
+      for(int i = 0; i < nrow; i++){
+        for(int j = 0; j < ncol; j++)
+          cells[j] = r_elt_to_js(isolate, x, i + (R_xlen_t) j * nrow);
+        rows[i] = new_array(context, cells);
+      }
+      return new_array(context, rows);
+    }
+    if(typed && Rf_isNull(Rf_getAttrib(x, R_NamesSymbol)) && !Rf_isFactor(x)){
+      v8::Local<v8::Value> array = r_to_typed_array(isolate, x, copy);
+      if(!array.IsEmpty())
+        return array;
+    }
+    if(auto_unbox && n == 1)
+      return r_elt_to_js(isolate, x, 0);
+    std::vector<v8::Local<v8::Value>> values(n);
+    for(R_xlen_t i = 0; i < n; i++)
+      values[i] = r_elt_to_js(isolate, x, i);
+    return new_array(context, values);
+  }
+  case VECSXP: {
+    if(Rf_inherits(x, "data.frame"))
+      return r_df_to_js(context, x);
+    if(!Rf_isNull(Rf_getAttrib(x, R_ClassSymbol)))
+      return v8::Local<v8::Value>();
+    R_xlen_t n = Rf_xlength(x);
+    SEXP names = Rf_getAttrib(x, R_NamesSymbol);
+    std::vector<v8::Local<v8::Value>> values(n);
+    for(R_xlen_t i = 0; i < n; i++){
+      values[i] = r_to_js(context, VECTOR_ELT(x, i), auto_unbox, typed, copy);
+      if(values[i].IsEmpty())
+        return v8::Local<v8::Value>();
+    }
+    if(Rf_isNull(names))
+      return new_array(context, values);
+    v8::Local<v8::Object> obj = v8::Object::New(isolate);
+    for(R_xlen_t i = 0; i < n; i++){
+      if(STRING_ELT(names, i) == NA_STRING || !strlen(CHAR(STRING_ELT(names, i))))
+        return v8::Local<v8::Value>();
+      obj->Set(context, ToJSString(Rf_translateCharUTF8(STRING_ELT(names, i))), values[i]).FromMaybe(false);
+    }
+    return obj;
+  }
+  default:
+    return v8::Local<v8::Value>();
+  }
+}
+
+/* Assign to a global variable (delete first if exists) */
+static bool assign_global(v8::Local<v8::Context> context, const char * key, v8::Local<v8::Value> value){
+  v8::Local<v8::String> name = ToJSString(key);
+  v8::Local<v8::Object> global = context->Global();
+  if(!global->Has(context, name).FromMaybe(true) || !global->Delete(context, name).IsNothing())
+    return !global->Set(context, name, value).IsNothing();
+  return false;
+}
+
+/* See https://groups.google.com/g/v8-users/c/r8nn6m6Lsj4/m/WrjLpk1PBAAJ */
+static v8::Local<v8::Value> await_promise(v8::Isolate *isolate, v8::Local<v8::Value> result){
+  if (!result->IsPromise())
+    return result;
+  v8::Local<v8::Promise> promise = result.As<v8::Promise>();
+  task_waiter waiter(isolate);
+  while (promise->State() == v8::Promise::kPending){
+    waiter.run();
+    check_heap_limit(isolate);
+    Rcpp::checkUserInterrupt();
+  }
+  if (promise->State() == v8::Promise::kRejected) {
+    v8::String::Utf8Value rejectmsg(isolate, promise->Result());
+    throw std::runtime_error(ToCString(rejectmsg));
+  }
+  return promise->Result();
+}
+
+/* Compiles and runs a script, and optionally waits for the resulting promise.
+ * Throws a C++ exception if the script fails. */
+static v8::Local<v8::Value> run_source(std::string srcstr, v8::Local<v8::Context> context, bool await, std::string cache){
+  // Compile source code (optionally via the code cache)
+  v8::Isolate *isolate = context->GetIsolate();
+  v8::TryCatch trycatch(isolate);
+  bool use_cache = cache.length() && srcstr.length() >= code_cache_min_size;
+  bool cache_stale = false;
+  std::string cache_file = use_cache ? code_cache_path(cache, srcstr) : "";
+  v8::Local<v8::Script> script = use_cache ?
+    compile_cached(srcstr, context, cache_file, &cache_stale) : compile_source(srcstr, context);
+  if(script.IsEmpty()) {
+    v8::String::Utf8Value exception(isolate, trycatch.Exception());
+    if(*exception){
+      throw std::invalid_argument(ToCString(exception));
+    } else {
+      throw std::runtime_error("Failed to interpret script. Check memory/stack limits.");
+    }
+  }
+
+  // Run the script to get the result.
+  v8::MaybeLocal<v8::Value> res = script->Run(context);
+  v8::Local<v8::Value> result = safe_to_local(res);
+  if(result.IsEmpty()){
+    check_heap_limit(isolate);
+    v8::String::Utf8Value exception(isolate, trycatch.Exception());
+    throw std::runtime_error(ToCString(exception));
+  }
+
+  /* Create the cache after running, such that it includes lazily compiled functions */
+#ifdef HAS_CODE_CACHE
+  if(cache_stale)
+    write_code_cache(cache_file, script);
+#endif
+
+  /* Promises that depend on background threads (e.g. to load wasm) are resolved
+   by task_waiter, see also
+   https://docs.google.com/document/d/18vaABH1mR35PQr8XPHZySuQYgSjJbWFyAW63LW2m8-w
+  */
+  return await ? await_promise(isolate, result) : result;
+}
+
+/* Convert to R without going through JSON */
+static Rcpp::RObject result_to_r(v8::Local<v8::Context> context, v8::Local<v8::Value> result, bool simplify){
+  v8::Isolate *isolate = context->GetIsolate();
+  v8::TryCatch trycatch(isolate);
+  Rcpp::RObject out = js_to_r(context, result, simplify, 0);
+  if(trycatch.HasCaught()){
+    v8::String::Utf8Value exception(isolate, trycatch.Exception());
+    throw std::runtime_error(ToCString(exception));
+  }
+  return out;
+}
+
+/* Function arguments: raw vectors become Uint8Array, JS() code is evaluated,
+ * and objects without a native mapping are converted via toJSON() */
+static v8::Local<v8::Value> r_arg_to_js(v8::Local<v8::Context> context, SEXP x, bool auto_unbox){
+  v8::Isolate *isolate = context->GetIsolate();
+  if(TYPEOF(x) == RAWSXP)
+    return v8::Uint8Array::New(r_array_buffer(isolate, x, RAW(x), Rf_xlength(x), true), 0, Rf_xlength(x));
+  if(TYPEOF(x) == STRSXP && Rf_inherits(x, "JS_EVAL")){
+    std::string src;
+    for(R_xlen_t i = 0; i < Rf_xlength(x); i++)
+      src = src + (i ? "\n" : "") + Rf_translateCharUTF8(STRING_ELT(x, i));
+    return run_source("(" + src + ")", context, false, "");
+  }
+  v8::Local<v8::Value> out = r_to_js(context, x, auto_unbox);
+  if(out.IsEmpty()){
+    Rcpp::Function toJSON = Rcpp::Environment::namespace_env("jsonlite")["toJSON"];
+    std::string json = Rcpp::as<std::string>(toJSON(x, Rcpp::Named("auto_unbox") = auto_unbox));
+    out = safe_to_local(v8::JSON::Parse(context, ToJSString(json.c_str())));
+    if(out.IsEmpty())
+      throw std::runtime_error("Failed to convert argument to JSON");
+  }
+  return out;
+}
+
+/* Structured clone of a value with the ValueSerializer, which (unlike JSON) supports
+ * Map, Set, Date, RegExp, BigInt, typed arrays and cyclic references. The blob can be
+ * restored in any context with deserialize_value(). */
+static Rcpp::RawVector serialize_value(v8::Local<v8::Context> context, v8::Local<v8::Value> value){
+  v8::Isolate *isolate = context->GetIsolate();
+  v8::TryCatch trycatch(isolate);
+  v8::ValueSerializer serializer(isolate);
+  serializer.WriteHeader();
+  if(!serializer.WriteValue(context, value).FromMaybe(false)){
+    v8::String::Utf8Value exception(isolate, trycatch.Exception());
+    throw std::runtime_error(trycatch.HasCaught() ? ToCString(exception) : "Failed to serialize value");
+  }
+  std::pair<uint8_t*, size_t> buf = serializer.Release();
+  Rcpp::RawVector out(buf.second);
+  std::copy(buf.first, buf.first + buf.second, out.begin());
+  free(buf.first);
+  out.attr("class") = "v8_serialized";
+  return out;
+}
+
+static v8::Local<v8::Value> deserialize_value(v8::Local<v8::Context> context, Rcpp::RawVector blob){
+  v8::Isolate *isolate = context->GetIsolate();
+  v8::TryCatch trycatch(isolate);
+  v8::ValueDeserializer deserializer(isolate, blob.begin(), blob.size());
+  v8::Local<v8::Value> value;
+  if(!deserializer.ReadHeader(context).FromMaybe(false) || !deserializer.ReadValue(context).ToLocal(&value)){
+    v8::String::Utf8Value exception(isolate, trycatch.Exception());
+    throw std::runtime_error(trycatch.HasCaught() ? ToCString(exception) : "Failed to deserialize value");
+  }
+  return value;
+}
+
+// [[Rcpp::export]]
+Rcpp::RObject context_eval(Rcpp::String src, ctxptr ctx, bool serialize = false, bool await = false, std::string cache = ""){
+  // Test if context still exists
+  if(!ctx)
+    throw std::runtime_error("v8::Context has been disposed.");
+  release_r_buffers();
+
+  //converts input to UTF8 if needed
+  src.set_encoding(CE_UTF8);
+
+  // Create a scope
+  v8::Isolate *isolate = ctx.checked_get()->isolate;
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  v8::Local<v8::Context> context = ctx.checked_get()->Get();
+  v8::Context::Scope context_scope(context);
+  v8::Local<v8::Value> result = run_source(src, context, await, cache);
+
+  // Serialize to JSON or Raw
+  if(serialize == true)
+    return convert_object(result);
+
+  // Convert result to string
+  v8::String::Utf8Value utf8(isolate, result);
+  Rcpp::String str(*utf8);
+  str.set_encoding(CE_UTF8);
+  Rcpp::CharacterVector out(1);
+  out.at(0) = str;
+  return out;
+}
+
+/* Runs a compiled script and returns the result as a string, like context_eval() */
+static Rcpp::RObject run_script_output(v8::Local<v8::Script> script, v8::Local<v8::Context> context, v8::TryCatch &trycatch){
+  v8::Isolate *isolate = context->GetIsolate();
+  if(script.IsEmpty()) {
+    v8::String::Utf8Value exception(isolate, trycatch.Exception());
+    if(*exception){
+      throw std::invalid_argument(ToCString(exception));
+    } else {
+      throw std::runtime_error("Failed to interpret script. Check memory/stack limits.");
+    }
+  }
+  v8::Local<v8::Value> result = safe_to_local(script->Run(context));
+  if(result.IsEmpty()){
+    check_heap_limit(isolate);
+    v8::String::Utf8Value exception(isolate, trycatch.Exception());
+    throw std::runtime_error(ToCString(exception));
+  }
+
+  // Convert result to string
+  v8::String::Utf8Value utf8(isolate, result);
+  Rcpp::String str(*utf8);
+  str.set_encoding(CE_UTF8);
+  Rcpp::CharacterVector out(1);
+  out.at(0) = str;
+  return out;
+}
+
+#ifdef HAS_STREAMING
+/* Chunks are pushed from the main thread, and pulled by the V8 parser on a background thread */
+class chunk_stream : public v8::ScriptCompiler::ExternalSourceStream {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<std::pair<uint8_t*, size_t>> chunks;
+  bool done = false;
+  bool parsed = false;
+public:
+  ~chunk_stream(){
+    for(size_t i = 0; i < chunks.size(); i++)
+      delete[] chunks[i].first;
+  }
+  size_t GetMoreData(const uint8_t** src){
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this]{ return chunks.size() || done; });
+    if(chunks.empty())
+      return 0;
+    std::pair<uint8_t*, size_t> chunk = chunks.front();
+    chunks.pop_front();
+    *src = chunk.first; // V8 takes ownership
+    return chunk.second;
+  }
+  void push(const unsigned char *data, size_t len){
+    uint8_t *copy = new uint8_t[len];
+    memcpy(copy, data, len);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      chunks.push_back(std::make_pair(copy, len));
+    }
+    cv.notify_all();
+  }
+  void finish(){
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done = true;
+    }
+    cv.notify_all();
+  }
+  void set_parsed(){
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      parsed = true;
+    }
+    cv.notify_all();
+  }
+  void wait_parsed(){
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this]{ return parsed; });
+  }
+};
+
+/* Runs the V8 parser on one of the platform worker threads */
+class streaming_task : public v8::Task {
+  v8::ScriptCompiler::ScriptStreamingTask *task;
+  chunk_stream *stream;
+public:
+  streaming_task(v8::ScriptCompiler::ScriptStreamingTask *task, chunk_stream *stream) : task(task), stream(stream) {}
+  void Run(){
+    task->Run();
+    stream->set_parsed();
+  }
+};
+
+/* Builds the full source string that Compile() needs from the same chunks, directly
+ * in the V8 heap. Each chunk becomes part of a cons string, such that the source is
+ * copied once. A multibyte character that is split over two chunks is carried over. */
+class source_builder {
+  v8::Isolate *isolate;
+  v8::Local<v8::String> str;
+  std::string partial;
+  static size_t char_length(unsigned char c){
+    return c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+  }
+  // Number of bytes that form complete characters
+  static size_t complete_length(const unsigned char *data, size_t len){
+    for(size_t i = len; i > 0 && i + 4 > len; i--){
+      if((data[i - 1] & 0xC0) != 0x80)
+        return i - 1 + char_length(data[i - 1]) > len ? i - 1 : len;
+    }
+    return len;
+  }
+  void add(const char *data, size_t len){
+    if(!len)
+      return;
+    v8::Local<v8::String> piece = safe_to_local(v8::String::NewFromUtf8(isolate, data, v8::NewStringType::kNormal, (int) len));
+    if(!piece.IsEmpty())
+      piece = str.IsEmpty() ? piece : v8::String::Concat(isolate, str, piece);
+    if(piece.IsEmpty())
+      throw std::runtime_error("Failed to load JavaScript source. Check memory/stack limits.");
+    str = piece;
+  }
+public:
+  source_builder(v8::Isolate *isolate) : isolate(isolate) {}
+  void append(const unsigned char *data, size_t len){
+    if(partial.length()){
+      size_t take = std::min(char_length(partial[0]) - partial.length(), len);
+      partial.append((const char *) data, take);
+      data += take;
+      len -= take;
+      if(partial.length() < char_length(partial[0]))
+        return;
+      add(partial.data(), partial.length());
+      partial.clear();
+    }
+    size_t complete = complete_length(data, len);
+    add((const char *) data, complete);
+    partial.assign((const char *) data + complete, len - complete);
+  }
+  v8::Local<v8::String> finish(){
+    add(partial.data(), partial.length());
+    partial.clear();
+    return str.IsEmpty() ? v8::String::Empty(isolate) : str;
+  }
+};
+#endif
+
+/* Evaluates a script that is read in chunks by calling reader() until it returns
+ * an empty raw vector. With streaming compilation, parsing starts on a background
+ * thread while the remaining chunks are still being read. */
+// [[Rcpp::export]]
+Rcpp::RObject context_eval_stream(Rcpp::Function reader, ctxptr ctx, std::string name = ""){
+  // Test if context still exists
+  if(!ctx)
+    throw std::runtime_error("v8::Context has been disposed.");
+  release_r_buffers();
+
+  // Create a scope
+  v8::Isolate *isolate = ctx.checked_get()->isolate;
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  v8::Local<v8::Context> context = ctx.checked_get()->Get();
+  v8::Context::Scope context_scope(context);
+  v8::TryCatch trycatch(isolate);
+
+#ifdef HAS_STREAMING
+  chunk_stream *stream = new chunk_stream();
+  v8::ScriptCompiler::StreamedSource source(std::unique_ptr<v8::ScriptCompiler::ExternalSourceStream>(stream),
+                                            v8::ScriptCompiler::StreamedSource::UTF8);
+#if V8_VERSION_TOTAL >= 904
+  std::unique_ptr<v8::ScriptCompiler::ScriptStreamingTask> task(v8::ScriptCompiler::StartStreaming(isolate, &source));
+#else
+  std::unique_ptr<v8::ScriptCompiler::ScriptStreamingTask> task(v8::ScriptCompiler::StartStreamingScript(isolate, &source));
+#endif
+  platformptr->CallOnWorkerThread(std::unique_ptr<v8::Task>(new streaming_task(task.get(), stream)));
+
+  // V8 still needs the full source to compile the script after parsing
+  source_builder full_source(isolate);
+  try {
+    while(true){
+      Rcpp::RawVector chunk = reader();
+      if(!chunk.size())
+        break;
+      stream->push(chunk.begin(), chunk.size());
+      full_source.append(chunk.begin(), chunk.size());
+    }
+  } catch (...) {
+    stream->finish();
+    stream->wait_parsed();
+    throw;
+  }
+  stream->finish();
+  stream->wait_parsed();
+  v8::Local<v8::Script> script = safe_to_local(v8::ScriptCompiler::Compile(context, &source, full_source.finish(), make_origin(name, false)));
+#else
+  std::string src;
+  while(true){
+    Rcpp::RawVector chunk = reader();
+    if(!chunk.size())
+      break;
+    src.append((const char *) chunk.begin(), chunk.size());
+  }
+  v8::Local<v8::Script> script = compile_source(src, context);
+#endif
+  return run_script_output(script, context, trycatch);
+}
+
+/* Evaluates a local script file. Large ASCII files are read into a buffer that is
+ * owned by an external string, such that the source is not copied into the heap. */
+// [[Rcpp::export]]
+Rcpp::RObject context_eval_file(std::string path, ctxptr ctx){
+  // Test if context still exists
+  if(!ctx)
+    throw std::runtime_error("v8::Context has been disposed.");
+  release_r_buffers();
+
+  // Create a scope
+  v8::Isolate *isolate = ctx.checked_get()->isolate;
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  v8::Local<v8::Context> context = ctx.checked_get()->Get();
+  v8::Context::Scope context_scope(context);
+  v8::TryCatch trycatch(isolate);
+  v8::Local<v8::String> source_text = read_source(path);
+  if(source_text.IsEmpty())
+    throw std::runtime_error("Failed to load JavaScript source. Check memory/stack limits.");
+  v8::ScriptCompiler::Source source(source_text, make_origin(path, false));
+  v8::Local<v8::Script> script = safe_to_local(v8::ScriptCompiler::Compile(context, &source));
+  return run_script_output(script, context, trycatch);
+}
+
+// [[Rcpp::export]]
+Rcpp::RObject context_get(Rcpp::String src, ctxptr ctx, bool await = false, bool simplify = true, bool copy = true){
+  // Test if context still exists
+  if(!ctx)
+    throw std::runtime_error("v8::Context has been disposed.");
+  release_r_buffers();
+
+  //converts input to UTF8 if needed
+  src.set_encoding(CE_UTF8);
+
+  // Create a scope
+  v8::Isolate *isolate = ctx.checked_get()->isolate;
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  v8::Local<v8::Context> context = ctx.checked_get()->Get();
+  v8::Context::Scope context_scope(context);
+  v8::Local<v8::Value> result = run_source(src, context, await, "");
+
+#ifdef HAS_ZERO_COPY
+  /* Numeric typed arrays are always converted, such that copy never changes the type */
+  if(!copy && !result.IsEmpty() && (result->IsArrayBuffer() || result->IsArrayBufferView()) && !is_numeric_array(result))
+    return js_buffer_view(result, ctx);
+#endif
+
+  return result_to_r(context, result, simplify);
+}
+
+/* Runs the script, and returns a handle to the resulting promise (or a resolved
+ * promise for other values), to be settled by polling from the R event loop. */
+// [[Rcpp::export]]
+promiseptr context_eval_async(Rcpp::String src, ctxptr ctx, std::string cache = ""){
+  // Test if context still exists
+  if(!ctx)
+    throw std::runtime_error("v8::Context has been disposed.");
+  release_r_buffers();
+
+  //converts input to UTF8 if needed
+  src.set_encoding(CE_UTF8);
+
+  // Create a scope
+  v8::Isolate *isolate = ctx.checked_get()->isolate;
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  v8::Local<v8::Context> context = ctx.checked_get()->Get();
+  v8::Context::Scope context_scope(context);
+  v8::Local<v8::Value> result = run_source(src, context, false, cache);
+  v8::Local<v8::Promise> promise;
+  if(result->IsPromise()){
+    promise = result.As<v8::Promise>();
+  } else {
+    v8::Local<v8::Promise::Resolver> resolver = v8::Promise::Resolver::New(context).ToLocalChecked();
+    resolver->Resolve(context, result).FromMaybe(false);
+    promise = resolver->GetPromise();
+  }
+  return promiseptr(new promise_type(isolate, context, promise), true, R_NilValue, ctx);
+}
+
+/* Runs pending tasks, microtasks and timers without blocking, and returns the state
+ * of the promise, along with the delay (in seconds) after which to poll again. The
+ * value is returned as a string or serialized like context_eval(), or converted
+ * natively like context_get() if output is "native". */
+// [[Rcpp::export]]
+Rcpp::List promise_poll(promiseptr handle, std::string output = "string", bool simplify = true){
+  if(!handle)
+    throw std::runtime_error("Promise has been disposed.");
+  release_r_buffers();
+
+  // Create a scope
+  promise_type *ptr = handle.checked_get();
+  v8::Isolate *isolate = ptr->isolate;
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  v8::Local<v8::Context> context = ptr->context.Get(isolate);
+  v8::Context::Scope context_scope(context);
+
+  bool busy = false;
+  while(v8::platform::PumpMessageLoop(platformptr, isolate, v8::platform::MessageLoopBehavior::kDoNotWait))
+    busy = true;
+  isolate->PerformMicrotaskCheckpoint();
+  if(run_timers(isolate))
+    busy = true;
+  check_heap_limit(isolate);
+
+  v8::Local<v8::Promise> promise = ptr->promise.Get(isolate);
+  if(promise->State() == v8::Promise::kPending){
+    double delay = 50;
+    double timer_ms = next_timer(isolate);
+    if(busy){
+      delay = 0;
+    } else if(timer_ms >= 0){
+      delay = std::min(timer_ms, 100.0);
+    }
+#ifdef HAS_BACKGROUND_TASKS
+    if(isolate->HasPendingBackgroundTasks())
+      delay = std::min(delay, 5.0);
 #endif
-    return data;
+    return Rcpp::List::create(Rcpp::Named("state") = "pending", Rcpp::Named("delay") = delay / 1000);
+  }
+  v8::Local<v8::Value> result = promise->Result();
+  if(promise->State() == v8::Promise::kRejected){
+    v8::String::Utf8Value rejectmsg(isolate, result);
+    Rcpp::String msg(ToCString(rejectmsg));
+    msg.set_encoding(CE_UTF8);
+    return Rcpp::List::create(Rcpp::Named("state") = "rejected", Rcpp::Named("error") = msg);
+  }
+  Rcpp::RObject value;
+  if(output == "native"){
+    value = result_to_r(context, result, simplify);
+  } else if(output == "serialize"){
+    value = convert_object(result);
+  } else if(output == "v8"){
+    value = serialize_value(context, result);
+  } else {
+    v8::String::Utf8Value utf8(isolate, result);
+    Rcpp::String str(*utf8);
+    str.set_encoding(CE_UTF8);
+    value = Rcpp::CharacterVector::create(str);
+  }
+  return Rcpp::List::create(Rcpp::Named("state") = "fulfilled", Rcpp::Named("value") = value);
+}
+
+/* True for a plain property path such as 'JSON.stringify' or 'instance.exports.add' */
+static bool is_member_path(const std::string &str){
+  bool start = true;
+  for(size_t i = 0; i < str.length(); i++){
+    char c = str[i];
+    if(c == '.' && !start){
+      start = true;
+    } else if(isalpha((unsigned char) c) || c == '_' || c == '$' || (!start && isdigit((unsigned char) c))){
+      start = false;
+    } else {
+      return false;
+    }
+  }
+  return str.length() > 0 && !start;
+}
+
+static v8::Local<v8::Value> fun_receiver(v8::Isolate *isolate, fun_type *fun){
+  if(fun->receiver.IsEmpty())
+    return v8::Undefined(isolate);
+  return fun->receiver.Get(isolate);
+}
+
+// [[Rcpp::export]]
+funptr context_function(Rcpp::String src, ctxptr ctx){
+  // Test if context still exists
+  if(!ctx)
+    throw std::runtime_error("v8::Context has been disposed.");
+  release_r_buffers();
+
+  //converts input to UTF8 if needed
+  src.set_encoding(CE_UTF8);
+
+  // Create a scope
+  v8::Isolate *isolate = ctx.checked_get()->isolate;
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  v8::Local<v8::Context> context = ctx.checked_get()->Get();
+  v8::Context::Scope context_scope(context);
+
+  // Evaluate once, and keep a handle to the function. For a member path such
+  // as 'obj.method' the object is kept as well, to be used as the receiver.
+  std::string str(src);
+  str.erase(str.find_last_not_of(" \t\r\n") + 1);
+  str.erase(0, str.find_first_not_of(" \t\r\n"));
+  size_t dot = str.rfind('.');
+  v8::Local<v8::Value> fun;
+  v8::Local<v8::Value> receiver;
+  if(is_member_path(str) && dot != std::string::npos){
+    receiver = run_source(str.substr(0, dot), context, false, "");
+    if(!receiver->IsObject())
+      throw std::invalid_argument("Argument is not a function expression");
+    v8::TryCatch trycatch(isolate);
+    fun = safe_to_local(receiver.As<v8::Object>()->Get(context, ToJSString(str.substr(dot + 1).c_str())));
+    if(fun.IsEmpty()){
+      v8::String::Utf8Value exception(isolate, trycatch.Exception());
+      throw std::runtime_error(ToCString(exception));
+    }
+  } else {
+    fun = run_source("(" + str + "\n)", context, false, "");
+  }
+  if(!fun->IsFunction())
+    throw std::invalid_argument("Argument is not a function expression");
+  fun_type *out = new fun_type(isolate, context, fun.As<v8::Function>());
+  if(!receiver.IsEmpty())
+    out->receiver.Reset(isolate, receiver);
+  return funptr(out, true, R_NilValue, ctx);
+}
+
+// [[Rcpp::export]]
+Rcpp::RObject function_call(funptr fun, Rcpp::List args, bool auto_unbox = true, bool await = false, bool simplify = true){
+  // Test if function still exists
+  if(!fun)
+    throw std::runtime_error("JavaScript function has been disposed.");
+  release_r_buffers();
+
+  // Create a scope
+  v8::Isolate *isolate = fun.checked_get()->isolate;
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  v8::Local<v8::Context> context = fun.checked_get()->context.Get(isolate);
+  v8::Context::Scope context_scope(context);
+
+  // Call the function directly, no source code involved
+  std::vector<v8::Local<v8::Value>> argv(args.size());
+  for(size_t i = 0; i < argv.size(); i++)
+    argv[i] = r_arg_to_js(context, VECTOR_ELT(args, i), auto_unbox);
+  v8::TryCatch trycatch(isolate);
+  v8::Local<v8::Function> f = fun.checked_get()->fun.Get(isolate);
+  v8::Local<v8::Value> recv = fun_receiver(isolate, fun.checked_get());
+  v8::Local<v8::Value> result = safe_to_local(f->Call(context, recv, argv.size(), argv.data()));
+  if(result.IsEmpty()){
+    check_heap_limit(isolate);
+    v8::String::Utf8Value exception(isolate, trycatch.Exception());
+    throw std::runtime_error(ToCString(exception));
+  }
+  if(await)
+    result = await_promise(isolate, result);
+  return result_to_r(context, result, simplify);
+}
+
+// [[Rcpp::export]]
+Rcpp::List function_map(funptr fun, SEXP x, bool auto_unbox = true, bool await = false, bool simplify = true){
+  // Test if function still exists
+  if(!fun)
+    throw std::runtime_error("JavaScript function has been disposed.");
+  release_r_buffers();
+
+  // Create a scope once for the entire batch
+  v8::Isolate *isolate = fun.checked_get()->isolate;
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  v8::Local<v8::Context> context = fun.checked_get()->context.Get(isolate);
+  v8::Context::Scope context_scope(context);
+  v8::Local<v8::Function> f = fun.checked_get()->fun.Get(isolate);
+  v8::Local<v8::Value> recv = fun_receiver(isolate, fun.checked_get());
+
+  // Items are either the rows of a data frame, or the elements of a list
+  bool is_df = Rf_inherits(x, "data.frame");
+  std::vector<v8::Local<v8::String>> keys;
+  if(is_df && !r_df_columns(x, keys))
+    throw std::invalid_argument("Data frame columns must be atomic vectors");
+  R_xlen_t n = is_df ? Rf_xlength(Rf_getAttrib(x, R_RowNamesSymbol)) : Rf_xlength(x);
+  Rcpp::List results(n);
+  Rcpp::CharacterVector errors(n, NA_STRING);
+  for(R_xlen_t i = 0; i < n; i++){
+    if(i % 1000 == 999)
+      Rcpp::checkUserInterrupt();
+
+    // Local handles are released after each item
+    v8::HandleScope item_scope(isolate);
+    v8::TryCatch trycatch(isolate);
+    try {
+      v8::Local<v8::Value> arg = is_df ? v8::Local<v8::Value>(r_df_row_to_js(context, x, i, keys)) :
+        r_arg_to_js(context, VECTOR_ELT(x, i), auto_unbox);
+      v8::Local<v8::Value> result = safe_to_local(f->Call(context, recv, 1, &arg));
+      if(result.IsEmpty()){
+        check_heap_limit(isolate);
+        if(isolate->IsExecutionTerminating())
+          throw std::runtime_error("Execution was terminated");
+        v8::String::Utf8Value exception(isolate, trycatch.Exception());
+        SET_STRING_ELT(errors, i, Rf_mkCharCE(ToCString(exception), CE_UTF8));
+        continue;
+      }
+      if(await)
+        result = await_promise(isolate, result);
+      SET_VECTOR_ELT(results, i, js_to_r(context, result, simplify, 0));
+    } catch(std::exception &e) {
+      // Includes R errors from the toJSON() fallback in r_arg_to_js()
+      if(isolate->IsExecutionTerminating())
+        throw;
+      SET_STRING_ELT(errors, i, Rf_mkCharCE(e.what(), CE_UTF8));
+    }
+  }
+  return Rcpp::List::create(Rcpp::Named("result") = results, Rcpp::Named("error") = errors);
+}
+
+// [[Rcpp::export]]
+bool write_array_buffer(Rcpp::String key, Rcpp::RawVector data, ctxptr ctx, bool copy = true){
+  // Test if context still exists
+  if(!ctx)
+    throw std::runtime_error("v8::Context has been disposed.");
+  release_r_buffers();
+
+  // Create a scope
+  v8::Isolate *isolate = ctx.checked_get()->isolate;
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  v8::Local<v8::Context> context = ctx.checked_get()->Get();
+  v8::Context::Scope context_scope(context);
+  v8::TryCatch trycatch(isolate);
+
+  // Initiate ArrayBuffer and ArrayBufferView (uint8 typed array)
+  v8::Local<v8::ArrayBuffer> buffer = r_array_buffer(isolate, data, data.begin(), data.size(), copy);
+  v8::Local<v8::Uint8Array> typed_array = v8::Uint8Array::New(buffer, 0, data.size());
+
+  // Assign to object (delete first if exists)
+  return assign_global(context, key.get_cstring(), typed_array);
+}
+
+/* Arguments of console.r callbacks are converted natively, such that typed arrays
+ * become vectors, unless the R function needs the JSON string */
+static Rcpp::RObject callback_arg_to_r(v8::Local<v8::Context> context, v8::Local<v8::Value> value, bool json){
+  if(!json)
+    return result_to_r(context, value, true);
+  v8::Local<v8::String> str = safe_to_local(v8::JSON::Stringify(context, value));
+  if(str.IsEmpty())
+    throw std::runtime_error("Failed to convert argument to JSON");
+  Rcpp::CharacterVector out = Rcpp::CharacterVector::create(Rcpp::String(*v8::String::Utf8Value(context->GetIsolate(), str), CE_UTF8));
+  out.attr("class") = "json";
+  return out;
+}
+
+/* True if x contains values that a typed array cannot represent like toJSON() does */
+static bool has_non_finite(SEXP x){
+  R_xlen_t n = Rf_xlength(x);
+  if(TYPEOF(x) == INTSXP){
+    for(R_xlen_t i = 0; i < n; i++){
+      if(INTEGER(x)[i] == NA_INTEGER)
+        return true;
+    }
+  } else if(TYPEOF(x) == REALSXP){
+    for(R_xlen_t i = 0; i < n; i++){
+      if(!std::isfinite(REAL(x)[i]))
+        return true;
+    }
+  }
+  return false;
+}
+
+/* Values returned by console.r callbacks: JSON from toJSON() is parsed, numeric and
+ * integer vectors become Float64Array and Int32Array, raw vectors become Uint8Array,
+ * and other objects are converted like toJSON() would. Vectors with NA, NaN or Inf
+ * and matrices remain plain arrays. */
+static v8::Local<v8::Value> callback_result_to_js(v8::Local<v8::Context> context, SEXP x){
+  if(Rf_inherits(x, "json")){
+    v8::Local<v8::Value> out = safe_to_local(v8::JSON::Parse(context, ToJSString(Rf_translateCharUTF8(STRING_ELT(x, 0)))));
+    if(out.IsEmpty())
+      throw std::runtime_error("Failed to parse JSON");
+    return out;
+  }
+  if((TYPEOF(x) == REALSXP || TYPEOF(x) == INTSXP) && !has_non_finite(x)){
+    v8::Local<v8::Value> out = r_to_js(context, x, false, true);
+    if(!out.IsEmpty())
+      return out;
+  }
+  return r_arg_to_js(context, x, false);
+}
+
+/* Calls an exposed R function. Arguments and the return value are converted natively
+ * (or via toJSON() for the return value if needed). The function is wrapped in R
+ * such that errors are returned as a 'cb_error' string, see no_jumps(). */
+static void call_r_function(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  v8::Isolate *isolate = args.GetIsolate();
+  v8::Local<v8::Context> context = isolate->GetCurrentContext();
+  r_function *fn = (r_function *) args.Data().As<v8::External>()->Value();
+  flush_console(isolate);
+  try {
+    Rcpp::List rargs(args.Length());
+    for(int i = 0; i < args.Length(); i++)
+      rargs[i] = result_to_r(context, args[i], fn->simplify);
+    Rcpp::RObject out = fn->fun(rargs);
+    if(Rf_inherits(out, "cb_error")){
+      isolate->ThrowException(v8::Exception::Error(ToJSString(CHAR(STRING_ELT(out, 0)))));
+      return;
+    }
+    args.GetReturnValue().Set(r_arg_to_js(context, out, fn->auto_unbox));
+  } catch(const std::exception& e) {
+    isolate->ThrowException(v8::Exception::Error(ToJSString(e.what())));
+  }
+}
+
+// [[Rcpp::export]]
+bool context_expose(Rcpp::String name, Rcpp::Function fun, ctxptr ctx, bool auto_unbox = true, bool simplify = true){
+  // Test if context still exists
+  if(!ctx)
+    throw std::runtime_error("v8::Context has been disposed.");
+
+  // Create a scope
+  v8::Isolate *isolate = ctx.checked_get()->isolate;
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  v8::Local<v8::Context> context = ctx.checked_get()->Get();
+  v8::Context::Scope context_scope(context);
+
+  // The R function lives as long as the context. Exposing a name again replaces
+  // the entry, so earlier references to the JS function call the new R function.
+  context_state *cs = get_context_state(context, true);
+  if(!cs)
+    throw std::runtime_error("R functions cannot be exposed in this context");
+  std::string key(name.get_cstring());
+  std::map<std::string, r_function>::iterator it = cs->functions.find(key);
+  if(it == cs->functions.end()){
+    it = cs->functions.emplace(key, r_function(fun, auto_unbox, simplify)).first;
   } else {
-    //convert to string without jsonify
-    //v8::String::Utf8Value utf8(isolate, value);
-    v8::Local<v8::Object> obj1 = value->ToObject(isolate->GetCurrentContext()).ToLocalChecked();
-    v8::String::Utf8Value utf8(isolate, v8::JSON::Stringify(isolate->GetCurrentContext(), obj1).ToLocalChecked());
-    return Rcpp::CharacterVector::create(Rcpp::String(*utf8));
+    it->second = r_function(fun, auto_unbox, simplify);
   }
+  v8::Local<v8::External> data = v8::External::New(isolate, &it->second);
+  v8::Local<v8::FunctionTemplate> tpl = v8::FunctionTemplate::New(isolate, call_r_function, data);
+  v8::Local<v8::Function> jsfun = safe_to_local(tpl->GetFunction(context));
+  if(jsfun.IsEmpty())
+    throw std::runtime_error("Failed to create function");
+  jsfun->SetName(ToJSString(name.get_cstring()));
+  if(!assign_global(context, name.get_cstring(), jsfun))
+    throw std::runtime_error("Failed to assign variable: " + std::string(name.get_cstring()));
+  return true;
+}
+
+// [[Rcpp::export]]
+bool context_assign(Rcpp::String key, SEXP value, ctxptr ctx, bool auto_unbox = true, bool typed = false, bool copy = true){
+  // Test if context still exists
+  if(!ctx)
+    throw std::runtime_error("v8::Context has been disposed.");
+  release_r_buffers();
+
+  // Create a scope
+  v8::Isolate *isolate = ctx.checked_get()->isolate;
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  v8::Local<v8::Context> context = ctx.checked_get()->Get();
+  v8::Context::Scope context_scope(context);
+  v8::TryCatch trycatch(isolate);
+
+  // Returns false if the value needs to be converted via JSON instead
+  v8::Local<v8::Value> obj = r_to_js(context, value, auto_unbox, typed, copy);
+  if(obj.IsEmpty())
+    return false;
+  if(!assign_global(context, key.get_cstring(), obj))
+    throw std::runtime_error("Failed to assign variable: " + std::string(key.get_cstring()));
+  return true;
 }
 
+/* Evaluates code and returns the result serialized with the ValueSerializer */
 // [[Rcpp::export]]
-Rcpp::RObject context_eval(Rcpp::String src, ctxptr ctx, bool serialize = false, bool await = false){
+Rcpp::RawVector context_serialize(Rcpp::String src, ctxptr ctx, bool await = false){
   // Test if context still exists
   if(!ctx)
     throw std::runtime_error("v8::Context has been disposed.");
+  release_r_buffers();
 
   //converts input to UTF8 if needed
   src.set_encoding(CE_UTF8);
 
   // Create a scope
+  v8::Isolate *isolate = ctx.checked_get()->isolate;
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  v8::Local<v8::Context> context = ctx.checked_get()->Get();
+  v8::Context::Scope context_scope(context);
+  v8::Local<v8::Value> result = run_source(src, context, await, "");
+  return serialize_value(context, result);
+}
+
+/* Restores a value from context_serialize() into a global variable */
+// [[Rcpp::export]]
+bool context_deserialize(Rcpp::String key, Rcpp::RawVector blob, ctxptr ctx){
+  // Test if context still exists
+  if(!ctx)
+    throw std::runtime_error("v8::Context has been disposed.");
+
+  // Create a scope
+  v8::Isolate *isolate = ctx.checked_get()->isolate;
   v8::Isolate::Scope isolate_scope(isolate);
   v8::HandleScope handle_scope(isolate);
-  v8::Local<v8::Context> context = ctx.checked_get()->Get(isolate);
+  v8::Local<v8::Context> context = ctx.checked_get()->Get();
   v8::Context::Scope context_scope(context);
+  v8::Local<v8::Value> value = deserialize_value(context, blob);
+  if(!assign_global(context, key.get_cstring(), value))
+    throw std::runtime_error("Failed to assign variable: " + std::string(key.get_cstring()));
+  return true;
+}
 
-  // Compile source code
+/* WebAssembly modules are compiled with new WebAssembly.Module(), or with
+ * compileStreaming() when there is native code from the cache, because streaming
+ * compilation is the only public API that can deserialize a module. */
+static v8::Local<v8::Value> wasm_api(v8::Local<v8::Context> context, const char *name){
+  v8::Local<v8::Value> wasm = js_get(context, context->Global(), ToJSString("WebAssembly"));
+  if(!wasm->IsObject())
+    throw std::runtime_error("WebAssembly is not available in this context");
+  return js_get(context, wasm.As<v8::Object>(), ToJSString(name));
+}
+
+#ifdef HAS_WASM_CACHE
+/* Serialized code for the next streaming compilation, see wasm_streaming_cb() */
+static const std::vector<uint8_t> *wasm_native_code = NULL;
+static bool wasm_native_code_accepted = false;
+
+/* Called by WebAssembly.compileStreaming(), which we only support for buffers */
+static void wasm_streaming_cb(const v8::FunctionCallbackInfo<v8::Value>& args){
+  v8::Isolate *isolate = args.GetIsolate();
+  std::shared_ptr<v8::WasmStreaming> streaming = v8::WasmStreaming::Unpack(isolate, args.Data());
+  if(!args[0]->IsArrayBuffer() && !args[0]->IsArrayBufferView()){
+    streaming->Abort(v8::Exception::TypeError(ToJSString("WebAssembly.compileStreaming() requires a buffer")));
+    return;
+  }
+  if(wasm_native_code){
+    wasm_native_code_accepted = streaming->SetCompiledModuleBytes(wasm_native_code->data(), wasm_native_code->size());
+    wasm_native_code = NULL;
+  }
+  size_t length = 0;
+  unsigned char *data = buffer_data(args[0], &length);
+  streaming->OnBytesReceived(data, length);
+  streaming->Finish();
+}
+#endif
+
+static v8::Local<v8::Value> wasm_compile(v8::Local<v8::Context> context, Rcpp::RawVector bytes, const std::vector<uint8_t> *native_code){
+  v8::Isolate *isolate = context->GetIsolate();
   v8::TryCatch trycatch(isolate);
-  v8::Local<v8::Script> script = compile_source(src, context);
-  if(script.IsEmpty()) {
-    v8::String::Utf8Value exception(isolate, trycatch.Exception());
-    if(*exception){
-      throw std::invalid_argument(ToCString(exception));
-    } else {
-      throw std::runtime_error("Failed to interpret script. Check memory/stack limits.");
+  v8::Local<v8::Value> buf = v8::Uint8Array::New(r_array_buffer(isolate, bytes, RAW(bytes), bytes.size(), true), 0, bytes.size());
+  v8::Local<v8::Value> module;
+#ifdef HAS_WASM_CACHE
+  v8::Local<v8::Value> streaming = native_code ? wasm_api(context, "compileStreaming") : v8::Local<v8::Value>();
+  if(!streaming.IsEmpty() && streaming->IsFunction()){
+    wasm_native_code = native_code;
+    try {
+      v8::Local<v8::Value> promise = safe_to_local(streaming.As<v8::Function>()->Call(context, v8::Undefined(isolate), 1, &buf));
+      module = promise.IsEmpty() ? promise : await_promise(isolate, promise);
+    } catch (...) {
+      wasm_native_code = NULL;
+      throw;
     }
+    wasm_native_code = NULL;
   }
-
-  // Run the script to get the result.
-  v8::MaybeLocal<v8::Value> res = script->Run(context);
-  v8::Local<v8::Value> result = safe_to_local(res);
-  if(result.IsEmpty()){
+#endif
+  if(module.IsEmpty() && !trycatch.HasCaught()){
+    v8::Local<v8::Value> constructor = wasm_api(context, "Module");
+    if(!constructor->IsFunction())
+      throw std::runtime_error("WebAssembly.Module is not available in this context");
+    module = safe_to_local(constructor.As<v8::Function>()->NewInstance(context, 1, &buf));
+  }
+  if(module.IsEmpty()){
+    check_heap_limit(isolate);
     v8::String::Utf8Value exception(isolate, trycatch.Exception());
     throw std::runtime_error(ToCString(exception));
   }
+  return module;
+}
 
-  /* PumpMessageLoop is needed to load wasm from the background threads
-   After this we still need to call PerformMicrotaskCheckpoint to resolve outstanding promises
-   This may be better, but HasPendingBackgroundTasks() requires v8 8.3, see also
-   https://docs.google.com/document/d/18vaABH1mR35PQr8XPHZySuQYgSjJbWFyAW63LW2m8-w
-  */
+#ifdef HAS_WASM_CACHE
+/* Compiled modules by hash of the bytes. A CompiledWasmModule is not tied to an
+ * isolate, so all contexts share the native code, including code that was
+ * optimized later on. The cache file is written after compiling, and once more
+ * when the module is loaded again, such that it includes the optimized code. */
+typedef struct {
+  v8::CompiledWasmModule module;
+  bool saved;
+  unsigned long last_used;
+} wasm_cache_entry;
+
+/* The least recently used module is dropped when the cache is full */
+static const size_t wasm_cache_max_entries = 32;
+static unsigned long wasm_cache_clock = 0;
+
+/* Never destructed, because it holds native code that is owned by the wasm engine.
+ * Evicted entries only drop the reference, modules in use keep their code. */
+static std::map<std::string, wasm_cache_entry> & wasm_modules(){
+  static std::map<std::string, wasm_cache_entry> *modules = new std::map<std::string, wasm_cache_entry>();
+  return *modules;
+}
 
-  // while (v8::platform::PumpMessageLoop(platformptr, isolate, isolate->HasPendingBackgroundTasks() ?
-  //   v8::platform::MessageLoopBehavior::kWaitForWork : v8::platform::MessageLoopBehavior::kDoNotWait)){
-  // }
+static std::vector<uint8_t> read_cache_file(std::string path){
+  std::vector<uint8_t> out;
+  std::ifstream input(path, std::ios::binary | std::ios::ate);
+  if(input.fail())
+    return out;
+  std::streamsize len = input.tellg();
+  if(len <= 0)
+    return out;
+  out.resize(len);
+  input.seekg(0);
+  if(!input.read(reinterpret_cast<char*>(out.data()), len))
+    out.clear();
+  return out;
+}
 
+static void write_wasm_cache(std::string path, v8::CompiledWasmModule &compiled){
+  v8::OwnedBuffer data = compiled.Serialize();
+  if(data.size)
+    write_cache_file(path, data.buffer.get(), data.size);
+}
 
-  // See https://groups.google.com/g/v8-users/c/r8nn6m6Lsj4/m/WrjLpk1PBAAJ
-  if (await && result->IsPromise()) {
-    v8::Local<v8::Promise> promise = result.As<v8::Promise>();
-    while (promise->State() == v8::Promise::kPending)
-      pump_promises();
-    if (promise->State() == v8::Promise::kRejected) {
-      v8::String::Utf8Value rejectmsg(isolate, promise->Result());
-      throw std::runtime_error(ToCString(rejectmsg));
-    } else {
-      result = promise->Result();
+/* The key is a hash, so the bytes are compared to rule out a collision */
+static bool same_wire_bytes(v8::CompiledWasmModule &compiled, Rcpp::RawVector bytes){
+  v8::MemorySpan<const uint8_t> wire = compiled.GetWireBytesRef();
+  return wire.size() == (size_t) bytes.size() && (wire.size() == 0 || memcmp(wire.data(), RAW(bytes), wire.size()) == 0);
+}
+
+static v8::Local<v8::Value> wasm_cached_module(v8::Local<v8::Context> context, Rcpp::RawVector bytes, std::string cache){
+  v8::Isolate *isolate = context->GetIsolate();
+  char key[64];
+  snprintf(key, sizeof(key), "%016llx-%lx-%08x", (unsigned long long) fnv_hash(RAW(bytes), bytes.size()),
+           (unsigned long) bytes.size(), v8::ScriptCompiler::CachedDataVersionTag());
+  std::string path = cache.length() ? cache + "/" + key + ".wasmc" : "";
+  std::map<std::string, wasm_cache_entry>::iterator it = wasm_modules().find(key);
+  if(it != wasm_modules().end() && !same_wire_bytes(it->second.module, bytes)){
+    // Hash collision: compile without the cache files, and replace the entry
+    wasm_modules().erase(it);
+    it = wasm_modules().end();
+    path = "";
+  }
+  if(it != wasm_modules().end()){
+    it->second.last_used = ++wasm_cache_clock;
+    v8::Local<v8::Value> module = safe_to_local(v8::WasmModuleObject::FromCompiledModule(isolate, it->second.module));
+    if(module.IsEmpty())
+      throw std::runtime_error("Failed to load cached WebAssembly module");
+    if(path.length() && !it->second.saved){
+      write_wasm_cache(path, it->second.module);
+      it->second.saved = true;
     }
+    return module;
   }
-
-  // Serialize to JSON or Raw
-  if(serialize == true)
-    return convert_object(result);
-
-  // Convert result to string
-  v8::String::Utf8Value utf8(isolate, result);
-  Rcpp::String str(*utf8);
-  str.set_encoding(CE_UTF8);
-  Rcpp::CharacterVector out(1);
-  out.at(0) = str;
-  return out;
+  std::vector<uint8_t> native_code;
+  if(path.length())
+    native_code = read_cache_file(path);
+  wasm_native_code_accepted = false;
+  v8::Local<v8::Value> module = wasm_compile(context, bytes, native_code.size() ? &native_code : NULL);
+  if(!module->IsWasmModuleObject())
+    throw std::runtime_error("Failed to compile WebAssembly module");
+  v8::CompiledWasmModule compiled = module.As<v8::WasmModuleObject>()->GetCompiledModule();
+  if(path.length() && !wasm_native_code_accepted)
+    write_wasm_cache(path, compiled);
+  std::map<std::string, wasm_cache_entry> &modules = wasm_modules();
+  if(modules.size() >= wasm_cache_max_entries){
+    std::map<std::string, wasm_cache_entry>::iterator oldest = modules.begin();
+    for(it = modules.begin(); it != modules.end(); it++){
+      if(it->second.last_used < oldest->second.last_used)
+        oldest = it;
+    }
+    modules.erase(oldest);
+  }
+  modules.emplace(key, wasm_cache_entry{compiled, false, ++wasm_cache_clock});
+  return module;
 }
+#endif
 
+/* Compiles a WebAssembly module into a global variable. Modules are compiled once
+ * per R session, and with a cache directory the native code is also stored on disk
+ * and reused by new R sessions. */
 // [[Rcpp::export]]
-bool write_array_buffer(Rcpp::String key, Rcpp::RawVector data, ctxptr ctx){
+bool context_wasm_module(Rcpp::String key, Rcpp::RawVector bytes, ctxptr ctx, std::string cache = ""){
   // Test if context still exists
   if(!ctx)
     throw std::runtime_error("v8::Context has been disposed.");
+  release_r_buffers();
 
   // Create a scope
+  v8::Isolate *isolate = ctx.checked_get()->isolate;
   v8::Isolate::Scope isolate_scope(isolate);
   v8::HandleScope handle_scope(isolate);
-  v8::Local<v8::Context> context = ctx.checked_get()->Get(isolate);
+  v8::Local<v8::Context> context = ctx.checked_get()->Get();
   v8::Context::Scope context_scope(context);
-  v8::TryCatch trycatch(isolate);
+#ifdef HAS_WASM_CACHE
+  v8::Local<v8::Value> module = wasm_cached_module(context, bytes, cache);
+#else
+  v8::Local<v8::Value> module = wasm_compile(context, bytes, NULL);
+#endif
+  if(!assign_global(context, key.get_cstring(), module))
+    throw std::runtime_error("Failed to assign variable: " + std::string(key.get_cstring()));
+  return true;
+}
 
-  // Initiate ArrayBuffer and ArrayBufferView (uint8 typed array)
-  v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(isolate, data.size());
-  v8::Local<v8::Uint8Array> typed_array = v8::Uint8Array::New(buffer, 0, data.size());
+/* The ArrayBuffer of a WebAssembly.Memory (or another object with a buffer) */
+static v8::Local<v8::ArrayBuffer> memory_buffer(v8::Local<v8::Context> context, v8::Local<v8::Value> value){
+  if(value->IsObject() && !value->IsArrayBuffer() && !value->IsArrayBufferView() && !value->IsSharedArrayBuffer())
+    value = js_get(context, value.As<v8::Object>(), ToJSString("buffer"));
+  if(value->IsArrayBufferView())
+    value = value.As<v8::ArrayBufferView>()->Buffer();
+  if(!value->IsArrayBuffer())
+    throw std::invalid_argument("Object is not a WebAssembly.Memory or ArrayBuffer (shared memory is not supported)");
+  return value.As<v8::ArrayBuffer>();
+}
 
-#if V8_VERSION_TOTAL >= 1005 || NODEJS_LTS_API == 18
-  memcpy(buffer->Data(), data.begin(), data.size());
-#elif V8_VERSION_TOTAL < 901 || NODEJS_LTS_API == 16
-  memcpy(buffer->GetContents().Data(), data.begin(), data.size());
+static void check_memory_range(size_t size, double offset, double length){
+  // Also rejects NaN and infinite values
+  if(!std::isfinite(offset) || !std::isfinite(length) || !(offset >= 0) || !(length >= 0) || !(offset + length <= size)){
+    char msg[200];
+    snprintf(msg, sizeof(msg), "Range of %.0f bytes at offset %.0f is out of bounds for memory of %lu bytes",
+             length, offset, (unsigned long) size);
+    throw std::out_of_range(msg);
+  }
+}
+
+/* Returns a raw vector that is a live view on part of a WebAssembly.Memory or
+ * ArrayBuffer. Offsets are relative to the start of the underlying buffer. */
+// [[Rcpp::export]]
+Rcpp::RObject context_memory_view(Rcpp::String src, ctxptr ctx, double offset = 0, double length = -1){
+  // Test if context still exists
+  if(!ctx)
+    throw std::runtime_error("v8::Context has been disposed.");
+  release_r_buffers();
+
+  //converts input to UTF8 if needed
+  src.set_encoding(CE_UTF8);
+
+  // Create a scope
+  v8::Isolate *isolate = ctx.checked_get()->isolate;
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  v8::Local<v8::Context> context = ctx.checked_get()->Get();
+  v8::Context::Scope context_scope(context);
+  v8::Local<v8::ArrayBuffer> buffer = memory_buffer(context, run_source(src, context, false, ""));
+  size_t size = buffer->ByteLength();
+  if(length < 0)
+    length = std::max((double) size - offset, 0.0);
+  check_memory_range(size, offset, length);
+#ifdef HAS_ZERO_COPY
+  return new_buffer_view(buffer, offset, length, ctx);
 #else
-  memcpy(buffer->GetBackingStore()->Data(), data.begin(), data.size());
+  Rcpp::RawVector out(length);
+  if(length)
+    memcpy(out.begin(), buffer_contents(buffer) + (size_t) offset, length);
+  return out;
 #endif
+}
 
-  // Assign to object (delete first if exists)
-  v8::Local<v8::String> name = ToJSString(key.get_cstring());
-  v8::Local<v8::Object> global = context->Global();
-  if(!global->Has(context, name).FromMaybe(true) || !global->Delete(context, name).IsNothing())
-    return !global->Set(context, name, typed_array).IsNothing();
-  return false;
+/* Copies the contents of an atomic vector into a WebAssembly.Memory or ArrayBuffer
+ * at a byte offset, without creating an intermediate buffer */
+// [[Rcpp::export]]
+bool context_memory_write(Rcpp::String src, SEXP data, ctxptr ctx, double offset = 0){
+  // Test if context still exists
+  if(!ctx)
+    throw std::runtime_error("v8::Context has been disposed.");
+  release_r_buffers();
+
+  void *ptr;
+  size_t width;
+  switch(TYPEOF(data)){
+  case RAWSXP: ptr = RAW(data); width = 1; break;
+  case LGLSXP: ptr = LOGICAL(data); width = sizeof(int); break;
+  case INTSXP: ptr = INTEGER(data); width = sizeof(int); break;
+  case REALSXP: ptr = REAL(data); width = sizeof(double); break;
+  default: throw std::invalid_argument("Data must be a raw, logical, integer or numeric vector");
+  }
+  size_t bytes = Rf_xlength(data) * width;
+
+  //converts input to UTF8 if needed
+  src.set_encoding(CE_UTF8);
+
+  // Create a scope
+  v8::Isolate *isolate = ctx.checked_get()->isolate;
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  v8::Local<v8::Context> context = ctx.checked_get()->Get();
+  v8::Context::Scope context_scope(context);
+  v8::Local<v8::ArrayBuffer> buffer = memory_buffer(context, run_source(src, context, false, ""));
+  check_memory_range(buffer->ByteLength(), offset, bytes);
+  if(bytes)
+    memmove(buffer_contents(buffer) + (size_t) offset, ptr, bytes); // data may be a view on the same memory
+  return true;
 }
 
 // [[Rcpp::export]]
@@ -489,16 +3415,66 @@ bool context_validate(Rcpp::String src, ctxptr ctx) {
   src.set_encoding(CE_UTF8);
 
   // Create a scope
+  v8::Isolate *isolate = ctx.checked_get()->isolate;
   v8::Isolate::Scope isolate_scope(isolate);
   v8::HandleScope handle_scope(isolate);
-  v8::Context::Scope context_scope(ctx.checked_get()->Get(isolate));
+  v8::Context::Scope context_scope(ctx.checked_get()->Get());
 
   // Try to compile, catch errors
   v8::TryCatch trycatch(isolate);
-  v8::Local<v8::Script> script = compile_source(src, ctx.checked_get()->Get(isolate));
+  v8::Local<v8::Script> script = compile_source(src, ctx.checked_get()->Get());
   return !script.IsEmpty();
 }
 
+/* Sets the minimum level of console output, and where it is written */
+// [[Rcpp::export]]
+void context_console_options(ctxptr ctx, int level, Rcpp::RObject sink){
+  if(!ctx)
+    throw std::runtime_error("v8::Context has been disposed.");
+  v8::Isolate *isolate = ctx.checked_get()->isolate;
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  context_state *cs = get_context_state(ctx.checked_get()->Get(), true);
+  if(!cs)
+    throw std::runtime_error("Console output cannot be configured for this context");
+  flush_console(cs);
+  cs->console_level = level;
+  cs->console_sink = sink;
+}
+
+/* Starts capturing console output, or stops and returns the captured lines */
+// [[Rcpp::export]]
+Rcpp::CharacterVector context_console_capture(ctxptr ctx, bool capture){
+  if(!ctx)
+    throw std::runtime_error("v8::Context has been disposed.");
+  v8::Isolate *isolate = ctx.checked_get()->isolate;
+  v8::Isolate::Scope isolate_scope(isolate);
+  v8::HandleScope handle_scope(isolate);
+  context_state *cs = get_context_state(ctx.checked_get()->Get(), true);
+  if(!cs)
+    throw std::runtime_error("Console output cannot be captured for this context");
+  Rcpp::CharacterVector out;
+  if(capture){
+    flush_console(cs);
+  } else {
+    out = Rcpp::CharacterVector(cs->console.size());
+    for(size_t i = 0; i < cs->console.size(); i++)
+      out[i] = Rcpp::String(console_line(cs->console[i]), CE_UTF8);
+    cs->console.clear();
+    cs->console_size = 0;
+  }
+  cs->console_capture = capture;
+  return out;
+}
+
+/* Removes pending timers, e.g. of a context that is replaced by reset() */
+// [[Rcpp::export]]
+void context_clear_timers(ctxptr ctx){
+  if(!ctx)
+    return;
+  clear_timers(ctx.checked_get()->isolate, ctx.checked_get());
+}
+
 // [[Rcpp::export]]
 bool context_null(ctxptr ctx) {
   // Test if context still exists
@@ -506,8 +3482,11 @@ bool context_null(ctxptr ctx) {
 }
 
 v8::Local<v8::Object> console_template(){
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
   v8::Local<v8::ObjectTemplate> console = v8::ObjectTemplate::New(isolate);
   console->Set(ToJSString("log"), v8::FunctionTemplate::New(isolate, ConsoleLog));
+  console->Set(ToJSString("info"), v8::FunctionTemplate::New(isolate, ConsoleInfo));
+  console->Set(ToJSString("debug"), v8::FunctionTemplate::New(isolate, ConsoleDebug));
   console->Set(ToJSString("warn"), v8::FunctionTemplate::New(isolate, ConsoleWarn));
   console->Set(ToJSString("error"), v8::FunctionTemplate::New(isolate, ConsoleError));
   console->Set(ToJSString("pump"), v8::FunctionTemplate::New(isolate, ConsolePump));
@@ -522,14 +3501,39 @@ v8::Local<v8::Object> console_template(){
   return console->NewInstance(isolate->GetCurrentContext()).ToLocalChecked();
 }
 
-// [[Rcpp::export]]
-ctxptr make_context(bool set_console){
-  v8::Isolate::Scope isolate_scope(isolate);
-  v8::HandleScope handle_scope(isolate);
+/* Native callbacks that may be referenced from a startup snapshot */
+static const intptr_t * external_references(){
+  static const intptr_t refs[] = {
+    reinterpret_cast<intptr_t>(ConsoleLog),
+    reinterpret_cast<intptr_t>(ConsoleWarn),
+    reinterpret_cast<intptr_t>(ConsoleError),
+    reinterpret_cast<intptr_t>(ConsolePump),
+    reinterpret_cast<intptr_t>(console_r_call),
+    reinterpret_cast<intptr_t>(console_r_get),
+    reinterpret_cast<intptr_t>(console_r_eval),
+    reinterpret_cast<intptr_t>(console_r_assign),
+    reinterpret_cast<intptr_t>(GlobalSetTimeout),
+    reinterpret_cast<intptr_t>(GlobalSetInterval),
+    reinterpret_cast<intptr_t>(GlobalClearTimer),
+    reinterpret_cast<intptr_t>(GlobalQueueMicrotask),
+    reinterpret_cast<intptr_t>(ConsoleInfo),
+    reinterpret_cast<intptr_t>(ConsoleDebug),
+    0
+  };
+  return refs;
+}
+
+static v8::Local<v8::Context> new_context(v8::Isolate *isolate, bool set_console){
+  v8::EscapableHandleScope handle_scope(isolate);
   v8::Local<v8::ObjectTemplate> global = v8::ObjectTemplate::New(isolate);
 
   // emscripted requires a print function
   global->Set(ToJSString("print"), v8::FunctionTemplate::New(isolate, ConsoleLog));
+  global->Set(ToJSString("setTimeout"), v8::FunctionTemplate::New(isolate, GlobalSetTimeout));
+  global->Set(ToJSString("setInterval"), v8::FunctionTemplate::New(isolate, GlobalSetInterval));
+  global->Set(ToJSString("clearTimeout"), v8::FunctionTemplate::New(isolate, GlobalClearTimer));
+  global->Set(ToJSString("clearInterval"), v8::FunctionTemplate::New(isolate, GlobalClearTimer));
+  global->Set(ToJSString("queueMicrotask"), v8::FunctionTemplate::New(isolate, GlobalQueueMicrotask));
   v8::Local<v8::Context> context = v8::Context::New(isolate, NULL, global);
   if(*context == NULL)
     throw std::runtime_error("Failed to create new context. Check memory stack limits.");
@@ -546,6 +3550,511 @@ ctxptr make_context(bool set_console){
     if(context->Global()->Set(context, console, console_template()).IsNothing())
       Rcpp::warning("Could not set console.");
   }
-  ctx_type *ptr = new ctx_type(isolate, context);
+  return handle_scope.Escape(context);
+}
+
+/* Snapshot files start with a header such that we never feed V8 a blob from another version */
+static std::string snapshot_header(){
+  return std::string("V8SNAPSHOT\n") + v8::V8::GetVersion() + "\n";
+}
+
+/* A snapshot can only be loaded when creating an isolate, so each snapshot file
+ * gets its own isolate. Contexts with a heap limit create another isolate from the
+ * same blob. The blob must outlive these isolates, so when the file is changed, the
+ * old snapshot is only freed once all contexts that were created from it are gone. */
+typedef struct {
+  std::string key;    // modification time and size of the file
+  std::string data;
+  v8::StartupData blob;
+  v8::Isolate *isolate;
+  int contexts;       // live contexts that were created from the blob
+  bool replaced;      // the file has been changed
+} snapshot_data;
+
+static std::map<std::string, snapshot_data*> snapshot_isolates;
+static std::map<ctx_type*, snapshot_data*> snapshot_contexts;
+
+static void free_snapshot(snapshot_data *snapshot){
+  if(snapshot->isolate)
+    dispose_isolate(snapshot->isolate);
+  delete snapshot;
+}
+
+static void release_snapshot(ctx_type *context){
+  std::map<ctx_type*, snapshot_data*>::iterator it = snapshot_contexts.find(context);
+  if(it == snapshot_contexts.end())
+    return;
+  snapshot_data *snapshot = it->second;
+  snapshot_contexts.erase(it);
+  if(--snapshot->contexts == 0 && snapshot->replaced)
+    free_snapshot(snapshot);
+}
+
+static snapshot_data * read_snapshot(std::string path){
+  // Reuse the isolate unless the file has been changed
+  struct stat info;
+  if(stat(path.c_str(), &info))
+    throw std::runtime_error("Failed to open snapshot file: " + path);
+  std::string key = std::to_string((long long) info.st_mtime) + ":" + std::to_string((long long) info.st_size);
+  std::map<std::string, snapshot_data*>::iterator it = snapshot_isolates.find(path);
+  if(it != snapshot_isolates.end() && it->second->key == key)
+    return it->second;
+
+  std::ifstream input(path, std::ios::binary);
+  if(input.fail())
+    throw std::runtime_error("Failed to open snapshot file: " + path);
+  std::stringstream buffer;
+  buffer << input.rdbuf();
+  std::string data = buffer.str();
+  std::string header = snapshot_header();
+  if(data.compare(0, header.length(), header))
+    throw std::runtime_error("File is not a snapshot for this version of V8: " + path);
+  snapshot_data *snapshot = new snapshot_data();
+  snapshot->key = key;
+  snapshot->data = data;
+  snapshot->blob.data = snapshot->data.data() + header.length();
+  snapshot->blob.raw_size = snapshot->data.length() - header.length();
+#if V8_VERSION_TOTAL >= 900
+  if(!snapshot->blob.IsValid()){
+    delete snapshot;
+    throw std::runtime_error("Snapshot file is corrupted: " + path);
+  }
+#endif
+  snapshot->isolate = NULL;
+  snapshot->contexts = 0;
+  snapshot->replaced = false;
+  if(it != snapshot_isolates.end()){
+    it->second->replaced = true;
+    if(it->second->contexts == 0)
+      free_snapshot(it->second);
+  }
+  snapshot_isolates[path] = snapshot;
+  return snapshot;
+}
+
+static v8::Isolate * snapshot_isolate(snapshot_data *snapshot){
+  if(!snapshot->isolate)
+    snapshot->isolate = new_isolate(&snapshot->blob);
+  return snapshot->isolate;
+}
+
+// [[Rcpp::export]]
+bool write_snapshot(std::string path, Rcpp::String src, bool set_console){
+  //converts input to UTF8 if needed
+  src.set_encoding(CE_UTF8);
+  std::string blob;
+  {
+#if V8_VERSION_TOTAL >= 1200
+    std::unique_ptr<v8::ArrayBuffer::Allocator> allocator(v8::ArrayBuffer::Allocator::NewDefaultAllocator());
+    v8::Isolate::CreateParams create_params;
+    create_params.array_buffer_allocator = allocator.get();
+    create_params.external_references = external_references();
+    v8::SnapshotCreator creator(create_params);
+#else
+    v8::SnapshotCreator creator(external_references());
+#endif
+    v8::Isolate *isolate = creator.GetIsolate();
+    setup_isolate(isolate);
+    {
+      v8::HandleScope handle_scope(isolate);
+      creator.SetDefaultContext(v8::Context::New(isolate));
+      v8::Local<v8::Context> context = new_context(isolate, set_console);
+      v8::Context::Scope context_scope(context);
+      v8::TryCatch trycatch(isolate);
+      v8::Local<v8::Script> script = compile_source(src, context);
+      if(script.IsEmpty() || script->Run(context).IsEmpty()){
+        v8::String::Utf8Value exception(isolate, trycatch.Exception());
+        throw std::runtime_error(ToCString(exception));
+      }
+      creator.AddContext(context);
+    }
+    v8::StartupData data = creator.CreateBlob(v8::SnapshotCreator::FunctionCodeHandling::kClear);
+    if(!data.data || data.raw_size <= 0)
+      throw std::runtime_error("Failed to create snapshot");
+    blob.assign(data.data, data.raw_size);
+    delete[] data.data;
+  }
+  std::ofstream output(path, std::ios::binary);
+  output << snapshot_header() << blob;
+  output.close();
+  if(output.fail())
+    throw std::runtime_error("Failed to write snapshot file: " + path);
+  return true;
+}
+
+// [[Rcpp::export]]
+ctxptr make_context(bool set_console, std::string snapshot = "", double heap_limit = 0){
+  snapshot_data *data = snapshot.length() ? read_snapshot(snapshot) : NULL;
+  bool owns_isolate = heap_limit > 0;
+  v8::Isolate *isolate = owns_isolate ? new_isolate(data ? &data->blob : NULL, heap_limit) :
+    data ? snapshot_isolate(data) : main_isolate;
+  ctx_type *ptr = NULL;
+  {
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = data ?
+      safe_to_local(v8::Context::FromSnapshot(isolate, 0)) : new_context(isolate, set_console);
+    if(!context.IsEmpty())
+      ptr = new ctx_type(isolate, context, owns_isolate);
+  }
+  if(!ptr){
+    if(owns_isolate)
+      dispose_isolate(isolate);
+    throw std::runtime_error("Failed to create new context from snapshot.");
+  }
+  if(data){
+    data->contexts++;
+    snapshot_contexts[ptr] = data;
+  }
   return ctxptr(ptr);
 }
+
+/* Isolate pool: each worker thread owns an isolate with a single context.
+ * Workers never touch the R API, so data is exchanged as JSON strings, and
+ * all conversion happens on the main thread. */
+
+/* Default secondary thread stacks on MacOS are only 512kb */
+static const int kPoolMaxStackSize = 384 * 1024;
+
+typedef struct {
+  bool is_eval;
+  std::string src;   //source code, or function expression
+  std::string args;  //JSON array with arguments
+  std::string result;
+  std::string error;
+  bool ok;
+} pool_task;
+
+/* Worker isolates have no isolate_state, so the heap limit is tracked here. Like
+ * near_heap_limit_cb() the task is terminated, and reported as a failed task. */
+typedef struct {
+  v8::Isolate *isolate;
+  size_t initial_limit;
+  bool exceeded;
+} pool_heap_state;
+
+#ifdef HAS_HEAP_LIMIT
+static size_t pool_heap_limit_cb(void *data, size_t current_heap_limit, size_t initial_heap_limit){
+  pool_heap_state *heap = (pool_heap_state *) data;
+  heap->initial_limit = initial_heap_limit;
+  heap->exceeded = true;
+  heap->isolate->TerminateExecution();
+  return current_heap_limit + initial_heap_limit / 4;
+}
+#endif
+
+static void pool_check_heap_limit(pool_heap_state *heap, pool_task *task){
+  if(!heap->exceeded)
+    return;
+  heap->exceeded = false;
+  heap->isolate->CancelTerminateExecution();
+#ifdef HAS_HEAP_LIMIT
+  heap->isolate->RemoveNearHeapLimitCallback(pool_heap_limit_cb, heap->initial_limit);
+  heap->isolate->AddNearHeapLimitCallback(pool_heap_limit_cb, heap);
+#endif
+  heap->isolate->LowMemoryNotification();
+  char msg[100];
+  snprintf(msg, sizeof(msg), "JavaScript heap limit of %d MB exceeded", (int) (heap->initial_limit >> 20));
+  task->ok = false;
+  task->error = msg;
+}
+
+class isolate_pool {
+public:
+  isolate_pool(size_t size, double heap_limit);
+  ~isolate_pool();
+  size_t size(){ return workers.size(); }
+  void run_batch(std::vector<pool_task> &tasks, bool broadcast);
+
+private:
+  std::vector<std::thread> workers;
+  std::vector<v8::Isolate*> isolates;
+  std::vector<bool> busy;
+  std::vector<std::deque<pool_task*>> own_queue;
+  std::deque<pool_task*> queue;
+  std::mutex mutex;
+  std::condition_variable work_cv;
+  std::condition_variable done_cv;
+  size_t pending = 0;
+  size_t ready = 0;
+  bool stopping = false;
+  std::atomic<bool> cancelled{false}; // stops waiting for promises in the current batch
+  double heap_limit;                  // in MB, or 0 for the V8 default
+  pool_task* next_task(size_t id);
+  void set_idle(size_t id);
+  void finish_task();
+  void worker(size_t id);
+};
+
+static void run_pool_task(pool_task *task, v8::Isolate *isolate, v8::Local<v8::Context> context,
+                          std::map<std::string, v8::Global<v8::Function>> &functions, const std::atomic<bool> &cancelled){
+  v8::TryCatch trycatch(isolate);
+  v8::Local<v8::Value> result;
+  if(task->is_eval){
+    v8::Local<v8::Script> script = compile_source(task->src, context);
+    if(!script.IsEmpty())
+      result = safe_to_local(script->Run(context));
+  } else {
+    // Functions are compiled once per worker
+    v8::Local<v8::Function> fun;
+    std::map<std::string, v8::Global<v8::Function>>::iterator it = functions.find(task->src);
+    if(it != functions.end()){
+      fun = it->second.Get(isolate);
+    } else {
+      v8::Local<v8::Script> script = compile_source("(" + task->src + ")", context);
+      v8::Local<v8::Value> val = script.IsEmpty() ? v8::Local<v8::Value>() : safe_to_local(script->Run(context));
+      if(!val.IsEmpty() && !val->IsFunction())
+        isolate->ThrowException(ToJSString("Argument is not a function"));
+      if(!val.IsEmpty() && val->IsFunction()){
+        fun = val.As<v8::Function>();
+        functions[task->src].Reset(isolate, fun);
+      }
+    }
+    v8::Local<v8::Value> args = fun.IsEmpty() ? v8::Local<v8::Value>() :
+      safe_to_local(v8::JSON::Parse(context, ToJSString(task->args.c_str())));
+    if(!args.IsEmpty() && args->IsArray()){
+      v8::Local<v8::Array> array = args.As<v8::Array>();
+      std::vector<v8::Local<v8::Value>> argv;
+      for(uint32_t i = 0; i < array->Length(); i++)
+        argv.push_back(array->Get(context, i).ToLocalChecked());
+      result = safe_to_local(fun->Call(context, context->Global(), argv.size(), argv.data()));
+    }
+  }
+  if(!result.IsEmpty() && result->IsPromise()){
+    v8::Local<v8::Promise> promise = result.As<v8::Promise>();
+    task_waiter waiter(isolate);
+    // TerminateExecution() has no effect while waiting, so we also check the flag
+    while (promise->State() == v8::Promise::kPending && !isolate->IsExecutionTerminating() && !cancelled){
+      waiter.run();
+    }
+    if(promise->State() == v8::Promise::kPending){
+      task->ok = false;
+      task->error = "Execution terminated";
+      return;
+    }
+    if(promise->State() == v8::Promise::kRejected){
+      isolate->ThrowException(promise->Result());
+      result = v8::Local<v8::Value>();
+    } else if(promise->State() == v8::Promise::kFulfilled){
+      result = promise->Result();
+    }
+  }
+  v8::Local<v8::Value> json;
+  if(!result.IsEmpty() && result->IsUndefined()){
+    json = ToJSString("null");
+  } else if(!result.IsEmpty()){
+    json = safe_to_local(v8::JSON::Stringify(context, result));
+  }
+  if(json.IsEmpty() || !json->IsString()){
+    task->ok = false;
+    if(trycatch.HasTerminated()){
+      task->error = "Execution terminated";
+    } else if(trycatch.HasCaught()){
+      v8::String::Utf8Value exception(isolate, trycatch.Exception());
+      task->error = ToCString(exception);
+    } else {
+      task->error = "Value cannot be converted to JSON";
+    }
+  } else {
+    v8::String::Utf8Value utf8(isolate, json);
+    task->result = ToCString(utf8);
+    task->ok = true;
+  }
+}
+
+void isolate_pool::worker(size_t id){
+  std::unique_ptr<v8::ArrayBuffer::Allocator> allocator(v8::ArrayBuffer::Allocator::NewDefaultAllocator());
+  v8::Isolate::CreateParams create_params;
+  create_params.array_buffer_allocator = allocator.get();
+  set_heap_limit(create_params, heap_limit);
+  v8::Isolate *isolate = v8::Isolate::New(create_params);
+  pool_heap_state heap = {isolate, 0, false};
+#ifdef HAS_HEAP_LIMIT
+  isolate->AddNearHeapLimitCallback(pool_heap_limit_cb, &heap);
+#endif
+  std::map<std::string, v8::Global<v8::Function>> functions;
+  ctx_handle context;
+  {
+    v8::Locker locker(isolate);
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    uintptr_t CurrentStackPosition = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+    isolate->SetStackLimit(CurrentStackPosition - kPoolMaxStackSize);
+    v8::Local<v8::Context> ctx = v8::Context::New(isolate);
+    context.Reset(isolate, ctx);
+    v8::Context::Scope context_scope(ctx);
+    ctx->Global()->Set(ctx, ToJSString("global"), ctx->Global()).FromMaybe(false);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    isolates[id] = isolate;
+    ready++;
+  }
+  done_cv.notify_all();
+  while(pool_task *task = next_task(id)){
+    {
+      v8::Locker locker(isolate);
+      v8::Isolate::Scope isolate_scope(isolate);
+      v8::HandleScope handle_scope(isolate);
+      v8::Local<v8::Context> ctx = context.Get(isolate);
+      v8::Context::Scope context_scope(ctx);
+      try {
+        run_pool_task(task, isolate, ctx, functions, cancelled);
+      } catch(const std::exception &e) {
+        task->ok = false;
+        task->error = e.what();
+      }
+      pool_check_heap_limit(&heap, task);
+      // Clear a termination request that may have arrived after the task completed
+      set_idle(id);
+      isolate->CancelTerminateExecution();
+    }
+    finish_task();
+  }
+  {
+    v8::Locker locker(isolate);
+    functions.clear();
+    context.Reset();
+  }
+  isolate->Dispose();
+}
+
+pool_task* isolate_pool::next_task(size_t id){
+  std::unique_lock<std::mutex> lock(mutex);
+  work_cv.wait(lock, [&]{ return stopping || own_queue[id].size() || queue.size(); });
+  if(stopping)
+    return NULL;
+  std::deque<pool_task*> &source = own_queue[id].size() ? own_queue[id] : queue;
+  pool_task *task = source.front();
+  source.pop_front();
+  busy[id] = true;
+  return task;
+}
+
+void isolate_pool::set_idle(size_t id){
+  std::lock_guard<std::mutex> lock(mutex);
+  busy[id] = false;
+}
+
+void isolate_pool::finish_task(){
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending--;
+  }
+  done_cv.notify_all();
+}
+
+isolate_pool::isolate_pool(size_t size, double heap_limit) : isolates(size), busy(size), own_queue(size), heap_limit(heap_limit) {
+  for(size_t i = 0; i < size; i++)
+    workers.push_back(std::thread(&isolate_pool::worker, this, i));
+  std::unique_lock<std::mutex> lock(mutex);
+  done_cv.wait(lock, [&]{ return ready == workers.size(); });
+}
+
+isolate_pool::~isolate_pool(){
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    cancelled = true;
+    for(size_t i = 0; i < isolates.size(); i++)
+      isolates[i]->TerminateExecution();
+  }
+  work_cv.notify_all();
+  for(size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+}
+
+static void check_interrupt_fn(void *dummy) {
+  R_CheckUserInterrupt();
+}
+
+static bool pending_interrupt() {
+  return !(R_ToplevelExec(check_interrupt_fn, NULL));
+}
+
+/* Runs a batch of tasks and waits for all of them to complete (or be interrupted) */
+void isolate_pool::run_batch(std::vector<pool_task> &tasks, bool broadcast){
+  std::unique_lock<std::mutex> lock(mutex);
+  cancelled = false;
+  for(size_t i = 0; i < tasks.size(); i++){
+    if(broadcast){
+      own_queue[i % own_queue.size()].push_back(&tasks[i]);
+    } else {
+      queue.push_back(&tasks[i]);
+    }
+  }
+  pending += tasks.size();
+  work_cv.notify_all();
+  while(pending > 0){
+    if(done_cv.wait_for(lock, std::chrono::milliseconds(100)) == std::cv_status::timeout){
+      lock.unlock();
+      bool interrupted = pending_interrupt();
+      lock.lock();
+      if(interrupted){
+        // Drop queued tasks and terminate running ones
+        pending -= queue.size();
+        queue.clear();
+        for(size_t i = 0; i < own_queue.size(); i++){
+          pending -= own_queue[i].size();
+          own_queue[i].clear();
+        }
+        cancelled = true;
+        for(size_t i = 0; i < isolates.size(); i++){
+          if(busy[i])
+            isolates[i]->TerminateExecution();
+        }
+        done_cv.wait(lock, [&]{ return pending == 0; });
+        throw std::runtime_error("Interrupted by user");
+      }
+    }
+  }
+}
+
+void pool_finalizer(isolate_pool *pool){
+  delete pool;
+}
+
+// [[Rcpp::export]]
+poolptr pool_new(int size, double heap_limit = 0){
+  if(size < 1)
+    throw std::runtime_error("Pool size must be at least 1");
+  return poolptr(new isolate_pool(size, heap_limit));
+}
+
+// [[Rcpp::export]]
+Rcpp::List pool_run(poolptr pool, Rcpp::CharacterVector src, Rcpp::CharacterVector args, bool is_eval){
+  if(!pool)
+    throw std::runtime_error("Isolate pool has been closed.");
+  size_t n = is_eval ? pool->size() : args.size();
+  std::vector<pool_task> tasks(n);
+  for(size_t i = 0; i < n; i++){
+    tasks[i].is_eval = is_eval;
+    tasks[i].src = Rcpp::as<std::string>(src.at(0));
+    if(!is_eval)
+      tasks[i].args = Rcpp::as<std::string>(args.at(i));
+    tasks[i].ok = false;
+  }
+  pool->run_batch(tasks, is_eval);
+  Rcpp::CharacterVector result(n);
+  Rcpp::CharacterVector error(n);
+  for(size_t i = 0; i < n; i++){
+    if(tasks[i].ok){
+      result[i] = Rcpp::String(tasks[i].result, CE_UTF8);
+      error[i] = NA_STRING;
+    } else {
+      result[i] = NA_STRING;
+      error[i] = Rcpp::String(tasks[i].error, CE_UTF8);
+    }
+  }
+  return Rcpp::List::create(Rcpp::Named("result") = result, Rcpp::Named("error") = error);
+}
+
+// [[Rcpp::export]]
+int pool_size(poolptr pool){
+  return pool ? pool->size() : 0;
+}
+
+// [[Rcpp::export]]
+void pool_close(poolptr pool){
+  pool.release();
+}
@@ -205,7 +205,42 @@ std::string version(){
 }
 
 
-Rcpp::RObject context_eval(Rcpp::String src, ctxptr ctx, bool serialize = false, bool await = false){
+bool isolate_track_gc(SEXP ctx, bool enable){
+  throw std::runtime_error("Heap statistics are not supported in WebR");
+}
+
+
+Rcpp::List isolate_stats(SEXP ctx){
+  throw std::runtime_error("Heap statistics are not supported in WebR");
+}
+
+
+bool profiler_start(SEXP ctx, double interval = 1000){
+  throw std::runtime_error("CPU profiling is not supported in WebR");
+}
+
+
+Rcpp::List profiler_stop(SEXP ctx){
+  throw std::runtime_error("CPU profiling is not supported in WebR");
+}
+
+
+std::string isolate_heap_snapshot(std::string path, SEXP ctx){
+  throw std::runtime_error("Heap profiling is not supported in WebR");
+}
+
+
+bool isolate_sampling_start(SEXP ctx, double interval = 524288, int stack_depth = 16){
+  throw std::runtime_error("Heap profiling is not supported in WebR");
+}
+
+
+Rcpp::List isolate_sampling_stop(SEXP ctx){
+  throw std::runtime_error("Heap profiling is not supported in WebR");
+}
+
+
+Rcpp::RObject context_eval(Rcpp::String src, ctxptr ctx, bool serialize = false, bool await = false, std::string cache = ""){
   if(!ctx)
     throw std::runtime_error("v8::Context has been disposed.");
 
@@ -232,7 +267,105 @@ Rcpp::RObject context_eval(Rcpp::String src, ctxptr ctx, bool serialize = false,
 }
 
 
-bool write_array_buffer(Rcpp::String key, Rcpp::RawVector data, ctxptr ctx){
+// No streaming compilation in WebR: read all chunks first
+Rcpp::RObject context_eval_stream(Rcpp::Function reader, ctxptr ctx, std::string name = ""){
+  std::string src;
+  while(true){
+    Rcpp::RawVector chunk = reader();
+    if(!chunk.size())
+      break;
+    src.append((const char *) chunk.begin(), chunk.size());
+  }
+  return context_eval(Rcpp::String(src, CE_UTF8), ctx);
+}
+
+
+Rcpp::RObject context_eval_file(std::string path, ctxptr ctx){
+  std::ifstream input(path, std::ios::binary);
+  if(input.fail())
+    throw std::runtime_error("Failed to open file: " + path);
+  std::stringstream buffer;
+  buffer << input.rdbuf();
+  return context_eval(Rcpp::String(buffer.str(), CE_UTF8), ctx);
+}
+
+
+// No native conversion in WebR: round trip via JSON instead
+Rcpp::RObject context_get(Rcpp::String src, ctxptr ctx, bool await = false, bool simplify = true, bool copy = true){
+  Rcpp::RObject json = context_eval(src, ctx, true, await);
+  Rcpp::Function get_json_output = Rcpp::Environment::namespace_env("V8")["get_json_output"];
+  return get_json_output(json, Rcpp::Named("simplifyVector") = simplify);
+}
+
+
+void fun_finalizer(fun_type* fun){
+  delete fun;
+}
+
+
+void promise_finalizer(promise_type* promise){
+  delete promise;
+}
+
+
+promiseptr context_eval_async(Rcpp::String src, ctxptr ctx, std::string cache = ""){
+  throw std::runtime_error("Async evaluation is not supported in WebR");
+}
+
+
+Rcpp::List promise_poll(promiseptr handle, std::string output = "string", bool simplify = true){
+  throw std::runtime_error("Async evaluation is not supported in WebR");
+}
+
+
+funptr context_function(Rcpp::String src, ctxptr ctx){
+  if(!ctx)
+    throw std::runtime_error("v8::Context has been disposed.");
+  return funptr(new fun_type(ctx, src.get_cstring()));
+}
+
+
+// Generates the source code for the call, like ct$call() in earlier versions
+Rcpp::RObject function_call(funptr fun, Rcpp::List args, bool auto_unbox = true, bool await = false, bool simplify = true){
+  if(!fun)
+    throw std::runtime_error("JavaScript function has been disposed.");
+  Rcpp::Function raw_to_js = Rcpp::Environment::namespace_env("V8")["raw_to_js"];
+  Rcpp::Function toJSON = Rcpp::Environment::namespace_env("jsonlite")["toJSON"];
+  std::string src = "(" + fun->src + ")(";
+  for(R_xlen_t i = 0; i < args.size(); i++){
+    SEXP x = VECTOR_ELT(args, i);
+    Rcpp::RObject arg;
+    if(TYPEOF(x) == RAWSXP){
+      arg = raw_to_js(x);
+    } else if(TYPEOF(x) == STRSXP && Rf_inherits(x, "JS_EVAL")){
+      arg = x;
+    } else {
+      arg = toJSON(x, Rcpp::Named("auto_unbox") = auto_unbox);
+    }
+    src = src + (i ? "," : "") + Rcpp::as<std::string>(arg);
+  }
+  return context_get(src + ");", fun->ctx, await, simplify);
+}
+
+
+Rcpp::List function_map(funptr fun, SEXP x, bool auto_unbox = true, bool await = false, bool simplify = true){
+  if(Rf_inherits(x, "data.frame"))
+    throw std::runtime_error("Mapping over data frame rows is not supported in WebR");
+  R_xlen_t n = Rf_xlength(x);
+  Rcpp::List results(n);
+  Rcpp::CharacterVector errors(n, NA_STRING);
+  for(R_xlen_t i = 0; i < n; i++){
+    try {
+      SET_VECTOR_ELT(results, i, function_call(fun, Rcpp::List::create(VECTOR_ELT(x, i)), auto_unbox, await, simplify));
+    } catch(std::exception &e) {
+      SET_STRING_ELT(errors, i, Rf_mkCharCE(e.what(), CE_UTF8));
+    }
+  }
+  return Rcpp::List::create(Rcpp::Named("result") = results, Rcpp::Named("error") = errors);
+}
+
+
+bool write_array_buffer(Rcpp::String key, Rcpp::RawVector data, ctxptr ctx, bool copy = true){
   if(!ctx)
     throw std::runtime_error("v8::Context has been disposed.");
   int res = em_write_array_buffer(*ctx, key.get_cstring(), data.begin(), data.size());
@@ -244,6 +377,30 @@ bool write_array_buffer(Rcpp::String key, Rcpp::RawVector data, ctxptr ctx){
 }
 
 
+bool context_assign(Rcpp::String key, SEXP value, ctxptr ctx, bool auto_unbox = true, bool typed = false, bool copy = true){
+  return false;
+}
+
+
+/* No module cache in WebR: the bytes are copied to the worker and compiled there */
+bool context_wasm_module(Rcpp::String key, Rcpp::RawVector bytes, ctxptr ctx, std::string cache = ""){
+  std::string name(key.get_cstring());
+  write_array_buffer(key, bytes, ctx);
+  context_eval(Rcpp::String("var " + name + " = new WebAssembly.Module(" + name + ");"), ctx);
+  return true;
+}
+
+
+Rcpp::RObject context_memory_view(Rcpp::String src, ctxptr ctx, double offset = 0, double length = -1){
+  throw std::runtime_error("Views on WebAssembly memory are not supported in WebR");
+}
+
+
+bool context_memory_write(Rcpp::String src, SEXP data, ctxptr ctx, double offset = 0){
+  throw std::runtime_error("Writing to WebAssembly memory is not supported in WebR");
+}
+
+
 bool context_validate(Rcpp::String src, ctxptr ctx) {
   if(!ctx)
     throw std::runtime_error("v8::Context has been disposed.");
@@ -251,14 +408,77 @@ bool context_validate(Rcpp::String src, ctxptr ctx) {
 }
 
 
+Rcpp::RawVector context_serialize(Rcpp::String src, ctxptr ctx, bool await = false){
+  throw std::runtime_error("V8 serialization is not supported in WebR");
+}
+
+
+bool context_deserialize(Rcpp::String key, Rcpp::RawVector blob, ctxptr ctx){
+  throw std::runtime_error("V8 serialization is not supported in WebR");
+}
+
+
+bool context_expose(Rcpp::String name, Rcpp::Function fun, ctxptr ctx, bool auto_unbox = true, bool simplify = true){
+  throw std::runtime_error("Exposing R functions is not supported in WebR, use console.r.call() instead");
+}
+
+
+void context_console_options(ctxptr ctx, int level, Rcpp::RObject sink){
+  throw std::runtime_error("Console options are not supported in WebR");
+}
+
+
+Rcpp::CharacterVector context_console_capture(ctxptr ctx, bool capture){
+  throw std::runtime_error("Capturing console output is not supported in WebR");
+}
+
+
+void context_clear_timers(ctxptr ctx){
+  // WebR has no timers
+}
+
+
 bool context_null(ctxptr ctx) {
   // Test if context still exists
   return(!ctx);
 }
 
 
-ctxptr make_context(bool set_console){
+bool write_snapshot(std::string path, Rcpp::String src, bool set_console){
+  throw std::runtime_error("Snapshots are not supported in WebR");
+}
+
+
+ctxptr make_context(bool set_console, std::string snapshot = "", double heap_limit = 0){
+  if(snapshot.length())
+    throw std::runtime_error("Snapshots are not supported in WebR");
+  if(heap_limit > 0)
+    throw std::runtime_error("Heap limits are not supported in WebR");
   int ctx = em_make_context();
   ctx_type *ptr = new ctx_type(ctx);
   return ctxptr(ptr);
 }
+
+
+void pool_finalizer(isolate_pool *pool){
+  delete pool;
+}
+
+
+poolptr pool_new(int size, double heap_limit){
+  throw std::runtime_error("Isolate pools are not supported in WebR");
+}
+
+
+Rcpp::List pool_run(poolptr pool, Rcpp::CharacterVector src, Rcpp::CharacterVector args, bool is_eval){
+  throw std::runtime_error("Isolate pools are not supported in WebR");
+}
+
+
+int pool_size(poolptr pool){
+  return 0;
+}
+
+
+void pool_close(poolptr pool){
+}
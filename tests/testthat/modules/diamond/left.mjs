@@ -0,0 +1,3 @@
+import { counter } from './shared.mjs';
+counter.value += 1;
+export const left = counter;
@@ -0,0 +1,3 @@
+import { counter } from '../diamond/shared.mjs';
+counter.value += 10;
+export const right = counter;
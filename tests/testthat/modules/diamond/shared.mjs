@@ -0,0 +1,2 @@
+globalThis.shared_loads = (globalThis.shared_loads || 0) + 1;
+export const counter = { value: 0 };
@@ -0,0 +1,4 @@
+import { left } from './left.mjs';
+import { right } from './right.mjs';
+export const same = left === right;
+export const value = left.value;